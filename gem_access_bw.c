@@ -0,0 +1,278 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * CPU access bandwidth into buffer objects through every path the kernel
+ * offers: PWRITE/PREAD, WC mmap, GTT mmap and CPU mmap. Objects are accessed
+ * in BLOCK_SIZE blocks, visited sequentially, with a large stride or in a
+ * random order, and split evenly between the worker threads.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define BLOCK_SIZE 4096
+#define STRIDE_BLOCKS 16
+#define TARGET_BYTES (256ull << 20)
+#define MAX_THREADS 64
+
+enum path { PATH_PRW, PATH_WC, PATH_GTT, PATH_CPU, NUM_PATHS };
+enum pattern { SEQUENTIAL, STRIDED, RANDOM, NUM_PATTERNS };
+
+static const char *path_names[] = { "pread/pwrite", "wc", "gtt", "cpu" };
+static const char *pattern_names[] = { "seq", "stride", "random" };
+
+struct job {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	int fd;
+	uint32_t handle;
+	char *map;
+	enum path path;
+	bool write;
+	const unsigned *order;
+	unsigned first, count;
+	unsigned passes;
+	char *buf;
+};
+
+static void *job_thread(void *data)
+{
+	struct job *j = data;
+
+	pthread_barrier_wait(j->barrier);
+	for (unsigned p = 0; p < j->passes; p++) {
+		for (unsigned n = j->first; n < j->first + j->count; n++) {
+			uint64_t offset = (uint64_t)j->order[n] * BLOCK_SIZE;
+
+			if (j->path == PATH_PRW) {
+				if (j->write)
+					gem_write(j->fd, j->handle, offset,
+						  j->buf, BLOCK_SIZE);
+				else
+					gem_read(j->fd, j->handle, offset,
+						 j->buf, BLOCK_SIZE);
+			} else {
+				if (j->write)
+					memcpy(j->map + offset, j->buf, BLOCK_SIZE);
+				else
+					memcpy(j->buf, j->map + offset, BLOCK_SIZE);
+			}
+		}
+	}
+	pthread_barrier_wait(j->barrier);
+
+	return NULL;
+}
+
+static void build_order(unsigned *order, unsigned count, enum pattern pattern)
+{
+	unsigned n = 0;
+
+	switch (pattern) {
+	case SEQUENTIAL:
+		for (n = 0; n < count; n++)
+			order[n] = n;
+		break;
+	case STRIDED:
+		for (unsigned start = 0; start < STRIDE_BLOCKS; start++)
+			for (unsigned b = start; b < count; b += STRIDE_BLOCKS)
+				order[n++] = b;
+		break;
+	case RANDOM:
+		for (n = 0; n < count; n++)
+			order[n] = n;
+		for (n = count - 1; n > 0; n--) {
+			unsigned r = random() % (n + 1);
+			unsigned tmp = order[n];
+
+			order[n] = order[r];
+			order[r] = tmp;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static double measure(int fd, uint32_t handle, char *map, enum path path,
+		      bool write, const unsigned *order, unsigned blocks,
+		      unsigned nthreads)
+{
+	struct job job[MAX_THREADS];
+	pthread_barrier_t barrier;
+	struct timespec start = {};
+	unsigned passes, per_thread;
+	uint64_t elapsed;
+
+	if (nthreads > blocks)
+		nthreads = blocks;
+	per_thread = blocks / nthreads;
+
+	passes = TARGET_BYTES / ((uint64_t)blocks * BLOCK_SIZE);
+	if (!passes)
+		passes = 1;
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (unsigned t = 0; t < nthreads; t++) {
+		job[t].barrier = &barrier;
+		job[t].fd = fd;
+		job[t].handle = handle;
+		job[t].map = map;
+		job[t].path = path;
+		job[t].write = write;
+		job[t].order = order;
+		job[t].first = t * per_thread;
+		job[t].count = per_thread;
+		job[t].passes = passes;
+		job[t].buf = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+		assert(job[t].buf);
+		memset(job[t].buf, t + 1, BLOCK_SIZE);
+
+		assert(pthread_create(&job[t].thread, NULL, job_thread, &job[t]) == 0);
+	}
+
+	pthread_barrier_wait(&barrier);
+	nsec_elapsed(&start);
+	pthread_barrier_wait(&barrier);
+	elapsed = nsec_elapsed(&start);
+
+	for (unsigned t = 0; t < nthreads; t++) {
+		pthread_join(job[t].thread, NULL);
+		free(job[t].buf);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	return (double)passes * nthreads * per_thread * BLOCK_SIZE / elapsed;
+}
+
+static char *map_path(int fd, uint32_t handle, uint64_t size, enum path path)
+{
+	switch (path) {
+	case PATH_WC:
+		gem_set_domain(fd, handle, I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+		return __gem_mmap__wc(fd, handle, 0, size, PROT_READ | PROT_WRITE);
+	case PATH_GTT:
+		gem_set_domain(fd, handle, I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+		return __gem_mmap__gtt(fd, handle, size, PROT_READ | PROT_WRITE);
+	case PATH_CPU:
+		gem_set_domain(fd, handle, I915_GEM_DOMAIN_CPU, I915_GEM_DOMAIN_CPU);
+		return __gem_mmap__cpu(fd, handle, 0, size, PROT_READ | PROT_WRITE);
+	default:
+		return NULL;
+	}
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m max-size-MiB] [-g max-gtt-MiB] [-t max-threads]\n"
+	       "  -m  sweep object sizes from 4KiB to max-size (default 1024)\n"
+	       "  -g  largest object accessed through the GTT, which must fit\n"
+	       "      in the mappable aperture (default 128)\n"
+	       "  -t  sweep threads from 1 to max-threads (default 4)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t max_size = 1024ull << 20, max_gtt = 128ull << 20;
+	unsigned max_threads = 4;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "m:g:t:h")) != -1) {
+		switch (c) {
+		case 'm':
+			max_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'g':
+			max_gtt = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!max_threads || max_threads > MAX_THREADS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	printf("%-12s %-5s %-6s %10s %7s %10s\n",
+	       "path", "dir", "order", "size(KiB)", "threads", "GB/s");
+	for (uint64_t size = 4096; size <= max_size; size <<= 2) {
+		unsigned blocks = size / BLOCK_SIZE;
+		uint32_t handle = gem_create(fd, size);
+		unsigned *order;
+
+		order = calloc(blocks, sizeof(*order));
+		assert(order);
+
+		for (enum path path = 0; path < NUM_PATHS; path++) {
+			char *map = NULL;
+
+			if (path == PATH_GTT && size > max_gtt)
+				continue;
+
+			if (path != PATH_PRW) {
+				map = map_path(fd, handle, size, path);
+				if (!map) {
+					printf("%-12s unavailable\n", path_names[path]);
+					continue;
+				}
+			}
+
+			for (int write = 1; write >= 0; write--) {
+				for (enum pattern pat = 0; pat < NUM_PATTERNS; pat++) {
+					build_order(order, blocks, pat);
+					for (unsigned t = 1; t <= max_threads; t <<= 1) {
+						double bw = measure(fd, handle, map,
+								    path, write,
+								    order, blocks, t);
+
+						printf("%-12s %-5s %-6s %10lu %7u %10.2f\n",
+						       path_names[path],
+						       write ? "write" : "read",
+						       pattern_names[pat],
+						       (unsigned long)(size >> 10),
+						       t, bw);
+						fflush(stdout);
+					}
+				}
+			}
+
+			if (map)
+				munmap(map, size);
+		}
+
+		free(order);
+		gem_close(fd, handle);
+	}
+
+	close(fd);
+	return 0;
+}
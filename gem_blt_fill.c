@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Clearing a surface with XY_COLOR_BLT against the cpu filling it through a
+ * WC mmap with streaming stores, across sizes, tiling and depth. Both sides
+ * are timed from the request to the surface being ready: submitting the blit
+ * and waiting for it on an idle engine, or moving the object to the GTT
+ * domain and filling it. The summary gives the size from which the blitter
+ * wins for each layout.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define LOOPS 32
+#define MAX_PITCH 16384
+#define SMALL_PITCH 512
+/* Y tiles are 32 rows tall, X tiles 8 */
+#define TILE_ROWS 32
+#define FILL_PATTERN 0x5a5a5a5a
+
+static const struct {
+	const char *name;
+	uint32_t tiling;
+} tilings[] = {
+	{ "linear", I915_TILING_NONE },
+	{ "X", I915_TILING_X },
+	{ "Y", I915_TILING_Y },
+};
+#define NUM_TILINGS (sizeof(tilings) / sizeof(tilings[0]))
+
+static const unsigned bpps[] = { 8, 16, 32 };
+#define NUM_BPPS (sizeof(bpps) / sizeof(bpps[0]))
+
+/* Median ns to fill @dst on an idle blitter, including the submission */
+static uint64_t blt_measure(int fd, const struct blt_surface *dst,
+			    unsigned bpp, uint32_t height)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj[2];
+	struct drm_i915_gem_relocation_entry reloc;
+	uint64_t samples[LOOPS];
+	uint32_t batch[16] = {}, *b;
+
+	b = blt_fill(batch, batch, &reloc, dst, bpp,
+		     dst->pitch * 8 / bpp, height, FILL_PATTERN);
+	assert(b);
+	*b++ = MI_BATCH_BUFFER_END;
+	if ((b - batch) & 1)
+		*b++ = 0;
+
+	memset(obj, 0, sizeof(obj));
+	obj[0].handle = dst->handle;
+	obj[1].handle = gem_create(fd, 4096);
+	obj[1].relocs_ptr = (uint64_t)&reloc;
+	obj[1].relocation_count = 1;
+	gem_write(fd, obj[1].handle, 0, batch, (b - batch) * sizeof(uint32_t));
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)obj;
+	execbuf.buffer_count = 2;
+	execbuf.batch_len = (b - batch) * sizeof(uint32_t);
+	execbuf.flags = I915_EXEC_BLT;
+
+	gem_execbuf(fd, &execbuf);
+	gem_sync(fd, obj[1].handle);
+
+	for (int n = 0; n < LOOPS; n++) {
+		struct timespec start = {};
+
+		nsec_elapsed(&start);
+		gem_execbuf(fd, &execbuf);
+		gem_sync(fd, obj[1].handle);
+		samples[n] = nsec_elapsed(&start);
+	}
+
+	gem_close(fd, obj[1].handle);
+
+	sort_u64(samples, LOOPS);
+	return percentile_u64(samples, LOOPS, 50);
+}
+
+/* Median ns to fill @size bytes of @handle through its WC mmap */
+static uint64_t cpu_measure(int fd, uint32_t handle, void *map, uint64_t size)
+{
+	uint64_t samples[LOOPS];
+
+	for (int n = 0; n < LOOPS; n++) {
+		struct timespec start = {};
+
+		nsec_elapsed(&start);
+		gem_set_domain(fd, handle,
+			       I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+		fill_to_wc(map, FILL_PATTERN, size);
+		samples[n] = nsec_elapsed(&start);
+	}
+
+	sort_u64(samples, LOOPS);
+	return percentile_u64(samples, LOOPS, 50);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m max-size-MiB]\n"
+	       "  -m  sweep surface sizes from 4KiB to max-size (default 64)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t crossover[NUM_TILINGS][NUM_BPPS] = {};
+	uint64_t max_size = 64 << 20;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "m:h")) != -1) {
+		switch (c) {
+		case 'm':
+			max_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (max_size < 4096 || max_size / MAX_PITCH > BLT_MAX_ROWS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	printf("%10s %-6s %4s %10s %10s %10s %10s\n", "size(KiB)",
+	       "tiling", "bpp", "blt(us)", "blt(GB/s)", "cpu(us)", "cpu(GB/s)");
+	for (uint64_t size = 4096; size <= max_size; size <<= 2) {
+		/* a 512 byte pitch keeps small surfaces a few tiles wide */
+		uint32_t pitch = size >= MAX_PITCH * TILE_ROWS ? MAX_PITCH : SMALL_PITCH;
+		uint32_t height = size / pitch;
+		uint64_t alloc = (uint64_t)pitch * ((height + TILE_ROWS - 1) & -TILE_ROWS);
+		uint32_t handle = gem_create(fd, alloc);
+		uint64_t cpu = 0;
+		void *map;
+
+		map = __gem_mmap__wc(fd, handle, 0, size, PROT_WRITE);
+		if (map) {
+			cpu = cpu_measure(fd, handle, map, size);
+			munmap(map, size);
+		}
+
+		for (unsigned t = 0; t < NUM_TILINGS; t++) {
+			struct blt_surface dst = {
+				.handle = handle,
+				.pitch = pitch,
+				.tiling = tilings[t].tiling,
+			};
+
+			for (unsigned d = 0; d < NUM_BPPS; d++) {
+				uint64_t blt = blt_measure(fd, &dst, bpps[d], height);
+
+				printf("%10lu %-6s %4u %10.1f %10.2f",
+				       (unsigned long)(size >> 10),
+				       tilings[t].name, bpps[d],
+				       blt / 1000.0, (double)size / blt);
+				if (cpu)
+					printf(" %10.1f %10.2f\n",
+					       cpu / 1000.0, (double)size / cpu);
+				else
+					printf(" %10s %10s\n", "n/a", "n/a");
+				fflush(stdout);
+
+				if (cpu && blt < cpu && !crossover[t][d])
+					crossover[t][d] = size;
+			}
+		}
+
+		gem_close(fd, handle);
+	}
+
+	printf("\nblitter faster from:\n");
+	for (unsigned t = 0; t < NUM_TILINGS; t++) {
+		for (unsigned d = 0; d < NUM_BPPS; d++) {
+			printf("  %-6s %2ubpp ", tilings[t].name, bpps[d]);
+			if (crossover[t][d])
+				printf("%lu KiB\n",
+				       (unsigned long)(crossover[t][d] >> 10));
+			else
+				printf("never\n");
+		}
+	}
+
+	close(fd);
+	return 0;
+}
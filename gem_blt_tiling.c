@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Blitter throughput between every pair of tiling modes, with the legacy
+ * XY_SRC_COPY_BLT (linear, X and Y only) against XY_FAST_COPY_BLT (gen9+,
+ * any tiling). Each surface is a full-size 32bpp image copied whole.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define LOOPS 32
+/* Widest tile (X and Ys) is 512 bytes, tallest (Ys) 128 rows */
+#define TILE_ALIGN 128
+
+static const struct {
+	const char *name;
+	uint32_t tiling;
+} tilings[] = {
+	{ "linear", I915_TILING_NONE },
+	{ "X", I915_TILING_X },
+	{ "Y", I915_TILING_Y },
+	{ "Yf", I915_TILING_Yf },
+	{ "Ys", I915_TILING_Ys },
+};
+#define NUM_TILINGS (sizeof(tilings) / sizeof(tilings[0]))
+
+typedef uint32_t *(*blt_func)(const uint32_t *batch, uint32_t *b,
+			      struct drm_i915_gem_relocation_entry *reloc,
+			      const struct blt_surface *src,
+			      const struct blt_surface *dst,
+			      uint32_t width, uint32_t height);
+
+/* A Ys tile is 64KiB and the blitter expects the surface to start on one */
+static uint64_t surface_alignment(const struct blt_surface *s)
+{
+	return s->tiling == I915_TILING_Ys ? 64 << 10 : 0;
+}
+
+/* Returns the ns per blit, or 0 if @blt cannot encode this combination */
+static uint64_t measure(int fd, blt_func blt,
+			const struct blt_surface *src,
+			const struct blt_surface *dst,
+			uint32_t width, uint32_t height)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj[3];
+	struct drm_i915_gem_relocation_entry reloc[2];
+	struct timespec start = {};
+	uint32_t batch[32] = {}, *b;
+	uint64_t elapsed;
+
+	b = blt(batch, batch, reloc, src, dst, width, height);
+	if (!b)
+		return 0;
+	*b++ = MI_BATCH_BUFFER_END;
+	if ((b - batch) & 1)
+		*b++ = 0;
+
+	memset(obj, 0, sizeof(obj));
+	obj[0].handle = src->handle;
+	obj[0].alignment = surface_alignment(src);
+	obj[1].handle = dst->handle;
+	obj[1].alignment = surface_alignment(dst);
+	obj[2].handle = gem_create(fd, 4096);
+	obj[2].relocs_ptr = (uint64_t)reloc;
+	obj[2].relocation_count = 2;
+	gem_write(fd, obj[2].handle, 0, batch, (b - batch) * sizeof(uint32_t));
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)obj;
+	execbuf.buffer_count = 3;
+	execbuf.batch_len = (b - batch) * sizeof(uint32_t);
+	execbuf.flags = I915_EXEC_BLT;
+
+	gem_execbuf(fd, &execbuf);
+	gem_sync(fd, obj[2].handle);
+
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++)
+		gem_execbuf(fd, &execbuf);
+	gem_sync(fd, obj[2].handle);
+	elapsed = nsec_elapsed(&start);
+
+	gem_close(fd, obj[2].handle);
+
+	return elapsed / LOOPS;
+}
+
+static void print_result(uint64_t ns, uint64_t bytes)
+{
+	if (ns)
+		printf(" %10.1f %10.2f", ns / 1000.0, (double)bytes / ns);
+	else
+		printf(" %10s %10s", "n/a", "n/a");
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-w width] [-H height] [-l]\n"
+	       "  -w  width of the surfaces in pixels (default 2048)\n"
+	       "  -H  height of the surfaces in pixels (default 2048)\n"
+	       "      both must be multiples of %d\n"
+	       "  -l  legacy XY_SRC_COPY_BLT only, for platforms before gen9\n",
+	       name, TILE_ALIGN);
+}
+
+int main(int argc, char **argv)
+{
+	struct blt_surface src[NUM_TILINGS], dst[NUM_TILINGS];
+	uint32_t width = 2048, height = 2048;
+	bool legacy_only = false;
+	uint64_t size;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "w:H:lh")) != -1) {
+		switch (c) {
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'l':
+			legacy_only = true;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!width || !height || width % TILE_ALIGN || height % TILE_ALIGN ||
+	    width * 4 >= 1 << 15) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+	size = (uint64_t)width * height * 4;
+
+	for (unsigned t = 0; t < NUM_TILINGS; t++) {
+		struct blt_surface s = {
+			.pitch = width * 4,
+			.tiling = tilings[t].tiling,
+		};
+
+		src[t] = dst[t] = s;
+		src[t].handle = gem_create(fd, size);
+		dst[t].handle = gem_create(fd, size);
+	}
+
+	printf("%ux%u 32bpp, %lu KiB per blit\n",
+	       width, height, (unsigned long)(size >> 10));
+	printf("%-6s %-6s %10s %10s %10s %10s\n", "src", "dst",
+	       "src(us)", "src(GB/s)", "fast(us)", "fast(GB/s)");
+	for (unsigned s = 0; s < NUM_TILINGS; s++) {
+		for (unsigned d = 0; d < NUM_TILINGS; d++) {
+			printf("%-6s %-6s", tilings[s].name, tilings[d].name);
+			print_result(measure(fd, blt_src_copy, &src[s], &dst[d],
+					     width, height), size);
+			print_result(legacy_only ? 0 :
+				     measure(fd, blt_fast_copy, &src[s], &dst[d],
+					     width, height), size);
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	for (unsigned t = 0; t < NUM_TILINGS; t++) {
+		gem_close(fd, src[t].handle);
+		gem_close(fd, dst[t].handle);
+	}
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Cost of keeping the cpu and gpu coherent, per round trip, under each of
+ * the models userspace can choose from:
+ *
+ *   set-domain  uncached object, cpu mmap, the kernel flushes on SET_DOMAIN
+ *   snoop       I915_CACHING_CACHED object, cpu mmap, no flushing at all
+ *   clflush     uncached object, cpu mmap, flushed by hand with
+ *               cpu_cache_flush() and never moved out of the gpu domain
+ *   wc          default caching, WC mmap, streaming copies
+ *
+ * "up" is the cpu writing the object and the blitter reading it, "down" the
+ * blitter writing it and the cpu reading it back. Every round trip is checked
+ * so that a model which is not actually coherent shows up as stale reads.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define LOOPS 32
+
+enum model { SET_DOMAIN, SNOOP, CLFLUSH, WC, NUM_MODELS };
+static const char *model_names[] = { "set-domain", "snoop", "clflush", "wc" };
+
+struct object {
+	enum model model;
+	uint32_t handle;
+	size_t size;
+	char *map;
+};
+
+static bool object_init(int fd, struct object *obj, enum model model, size_t size)
+{
+	obj->model = model;
+	obj->size = size;
+	obj->handle = gem_create(fd, size);
+
+	switch (model) {
+	case SET_DOMAIN:
+	case CLFLUSH:
+		if (__gem_set_caching(fd, obj->handle, I915_CACHING_NONE))
+			break;
+		obj->map = __gem_mmap__cpu(fd, obj->handle, 0, size,
+					   PROT_READ | PROT_WRITE);
+		break;
+	case SNOOP:
+		if (__gem_set_caching(fd, obj->handle, I915_CACHING_CACHED))
+			break;
+		obj->map = __gem_mmap__cpu(fd, obj->handle, 0, size,
+					   PROT_READ | PROT_WRITE);
+		break;
+	case WC:
+		obj->map = __gem_mmap__wc(fd, obj->handle, 0, size,
+					  PROT_READ | PROT_WRITE);
+		break;
+	default:
+		obj->map = NULL;
+		break;
+	}
+
+	if (!obj->map) {
+		gem_close(fd, obj->handle);
+		return false;
+	}
+
+	/* Start out in the gpu domain, after that only set-domain asks */
+	gem_set_domain(fd, obj->handle, I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+	return true;
+}
+
+static void object_fini(int fd, struct object *obj)
+{
+	munmap(obj->map, obj->size);
+	gem_close(fd, obj->handle);
+}
+
+static void cpu_write(int fd, struct object *obj, const void *src)
+{
+	switch (obj->model) {
+	case SET_DOMAIN:
+		gem_set_domain(fd, obj->handle,
+			       I915_GEM_DOMAIN_CPU, I915_GEM_DOMAIN_CPU);
+		memcpy(obj->map, src, obj->size);
+		break;
+	case SNOOP:
+		memcpy(obj->map, src, obj->size);
+		break;
+	case CLFLUSH:
+		memcpy(obj->map, src, obj->size);
+		cpu_cache_flush(obj->map, obj->size, false);
+		break;
+	case WC:
+		memcpy_to_wc(obj->map, src, obj->size);
+		break;
+	default:
+		break;
+	}
+}
+
+static void cpu_read(int fd, struct object *obj, void *dst)
+{
+	switch (obj->model) {
+	case SET_DOMAIN:
+		gem_set_domain(fd, obj->handle, I915_GEM_DOMAIN_CPU, 0);
+		memcpy(dst, obj->map, obj->size);
+		break;
+	case SNOOP:
+		memcpy(dst, obj->map, obj->size);
+		break;
+	case CLFLUSH:
+		cpu_cache_flush(obj->map, obj->size, true);
+		memcpy(dst, obj->map, obj->size);
+		break;
+	case WC:
+		memcpy_from_wc(dst, obj->map, obj->size);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The first and last dword of every round trip carry its sequence number */
+static void stamp(uint32_t *buf, size_t size, uint32_t seqno)
+{
+	buf[0] = seqno;
+	buf[size / 4 - 1] = seqno;
+}
+
+static bool stamped(const uint32_t *buf, size_t size, uint32_t seqno)
+{
+	return buf[0] == seqno && buf[size / 4 - 1] == seqno;
+}
+
+static void run(int fd, enum model model, size_t size)
+{
+	uint64_t up[LOOPS], down[LOOPS];
+	unsigned stale_up = 0, stale_down = 0;
+	struct object obj;
+	uint32_t batch, scratch, pattern[2];
+	uint32_t *buf;
+
+	if (!object_init(fd, &obj, model, size)) {
+		printf("%-10s %10lu unavailable\n", model_names[model],
+		       (unsigned long)(size >> 10));
+		return;
+	}
+
+	buf = aligned_alloc(4096, size);
+	assert(buf);
+	memset(buf, 0x5a, size);
+
+	batch = blt_linear_batch_create(fd, size);
+	scratch = gem_create(fd, size);
+	for (int i = 0; i < 2; i++) {
+		pattern[i] = gem_create(fd, size);
+		stamp(buf, size, ~i);
+		gem_write(fd, pattern[i], 0, buf, size);
+	}
+
+	/* cpu writes, gpu reads */
+	for (int n = 0; n < LOOPS; n++) {
+		struct timespec start = {};
+		uint32_t check[2];
+
+		stamp(buf, size, n);
+		nsec_elapsed(&start);
+		cpu_write(fd, &obj, buf);
+		blt_linear_execbuf(fd, batch, obj.handle, scratch, size);
+		gem_sync(fd, scratch);
+		up[n] = nsec_elapsed(&start);
+
+		gem_read(fd, scratch, 0, &check[0], 4);
+		gem_read(fd, scratch, size - 4, &check[1], 4);
+		if (check[0] != n || check[1] != n)
+			stale_up++;
+	}
+
+	/* gpu writes, cpu reads */
+	for (int n = 0; n < LOOPS; n++) {
+		struct timespec start = {};
+
+		nsec_elapsed(&start);
+		blt_linear_execbuf(fd, batch, pattern[n & 1], obj.handle, size);
+		gem_sync(fd, obj.handle);
+		cpu_read(fd, &obj, buf);
+		down[n] = nsec_elapsed(&start);
+
+		if (!stamped(buf, size, ~(n & 1)))
+			stale_down++;
+	}
+
+	sort_u64(up, LOOPS);
+	sort_u64(down, LOOPS);
+	printf("%-10s %10lu %8u %10.1f %10.2f %6u %10.1f %10.2f %6u\n",
+	       model_names[model], (unsigned long)(size >> 10),
+	       gem_get_caching(fd, obj.handle),
+	       percentile_u64(up, LOOPS, 50) / 1000.0,
+	       (double)size / percentile_u64(up, LOOPS, 50), stale_up,
+	       percentile_u64(down, LOOPS, 50) / 1000.0,
+	       (double)size / percentile_u64(down, LOOPS, 50), stale_down);
+	fflush(stdout);
+
+	for (int i = 0; i < 2; i++)
+		gem_close(fd, pattern[i]);
+	gem_close(fd, scratch);
+	gem_close(fd, batch);
+	free(buf);
+	object_fini(fd, &obj);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m max-size-KiB]\n"
+	       "  -m  sweep object sizes from 4KiB to max-size (default 16384,\n"
+	       "      less than 524288)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t max_size = 16 << 20;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "m:h")) != -1) {
+		switch (c) {
+		case 'm':
+			max_size = strtoull(optarg, NULL, 0) << 10;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (max_size < 4096 || max_size > BLT_LINEAR_MAX_SIZE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	printf("flush: %s, invalidate: %s\n",
+	       cpu_cache_flush_name(false), cpu_cache_flush_name(true));
+	printf("%-10s %10s %8s %10s %10s %6s %10s %10s %6s\n",
+	       "model", "size(KiB)", "caching",
+	       "up(us)", "up(GB/s)", "stale",
+	       "down(us)", "down(GB/s)", "stale");
+	for (size_t size = 4096; size <= max_size; size <<= 2)
+		for (enum model m = 0; m < NUM_MODELS; m++)
+			run(fd, m, size);
+
+	close(fd);
+	return 0;
+}
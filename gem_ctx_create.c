@@ -0,0 +1,283 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Cost of context creation, first submission and destruction as the number
+ * of live contexts grows, of per-session context churn from several threads,
+ * and of the same churn served from a gem_context_pool.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define SHARED_FD 0x1
+#define USE_POOL 0x2
+
+static uint32_t batch_create(int fd)
+{
+	const uint32_t bbe = MI_BATCH_BUFFER_END;
+	uint32_t handle;
+
+	handle = gem_create(fd, 4096);
+	gem_write(fd, handle, 0, &bbe, sizeof(bbe));
+
+	return handle;
+}
+
+static void submit(int fd, uint32_t handle, uint32_t ctx_id)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 exec;
+
+	memset(&exec, 0, sizeof(exec));
+	exec.handle = handle;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&exec;
+	execbuf.buffer_count = 1;
+	execbuf.flags = I915_EXEC_RENDER;
+	execbuf.rsvd1 = ctx_id;
+
+	gem_execbuf(fd, &execbuf);
+}
+
+/*
+ * Create @count contexts, submit to each twice, then destroy them all,
+ * reporting the average cost of every step per context.
+ */
+static void live_contexts(int fd, unsigned count)
+{
+	uint64_t create, first, second, destroy;
+	struct timespec start;
+	uint32_t *ctx;
+	uint32_t handle;
+
+	ctx = calloc(count, sizeof(*ctx));
+	assert(ctx);
+	handle = batch_create(fd);
+
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (unsigned n = 0; n < count; n++)
+		ctx[n] = gem_context_create(fd);
+	create = nsec_elapsed(&start);
+
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (unsigned n = 0; n < count; n++)
+		submit(fd, handle, ctx[n]);
+	gem_sync(fd, handle);
+	first = nsec_elapsed(&start);
+
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (unsigned n = 0; n < count; n++)
+		submit(fd, handle, ctx[n]);
+	gem_sync(fd, handle);
+	second = nsec_elapsed(&start);
+
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (unsigned n = 0; n < count; n++)
+		gem_context_destroy(fd, ctx[n]);
+	destroy = nsec_elapsed(&start);
+
+	printf("  %6u %12.2f %12.2f %12.2f %12.2f\n", count,
+	       create / count / 1000.0,
+	       first / count / 1000.0,
+	       second / count / 1000.0,
+	       destroy / count / 1000.0);
+	fflush(stdout);
+
+	gem_close(fd, handle);
+	free(ctx);
+}
+
+struct session {
+	pthread_t thread;
+	int fd;
+	unsigned flags;
+	int timeout;
+	struct gem_context_pool *pool;
+	uint64_t count;
+	uint64_t *samples;
+	unsigned max_samples;
+};
+
+/* One client session: acquire a context, run a batch on it, release it */
+static void *session_thread(void *data)
+{
+	struct session *s = data;
+	uint32_t handle = batch_create(s->fd);
+
+	until_timeout(s->timeout) {
+		struct timespec start = {};
+		uint32_t ctx_id;
+
+		nsec_elapsed(&start);
+		if (s->flags & USE_POOL)
+			ctx_id = gem_context_pool_get(s->pool);
+		else
+			ctx_id = gem_context_create(s->fd);
+
+		submit(s->fd, handle, ctx_id);
+
+		if (s->flags & USE_POOL)
+			gem_context_pool_put(s->pool, ctx_id);
+		else
+			gem_context_destroy(s->fd, ctx_id);
+
+		if (s->count < s->max_samples)
+			s->samples[s->count] = nsec_elapsed(&start);
+		s->count++;
+	}
+
+	gem_sync(s->fd, handle);
+	gem_close(s->fd, handle);
+	return NULL;
+}
+
+static void sessions(int fd, unsigned nthreads, unsigned flags, int timeout)
+{
+	const unsigned max_samples = 1 << 16;
+	struct gem_context_pool *pool = NULL;
+	struct session *s;
+	uint64_t *all, total = 0;
+	unsigned nsamples = 0;
+
+	s = calloc(nthreads, sizeof(*s));
+	assert(s);
+
+	if (flags & USE_POOL)
+		pool = gem_context_pool_create(fd, 2 * nthreads,
+					       LOCAL_I915_CONTEXT_DEFAULT_PRIORITY);
+
+	for (unsigned t = 0; t < nthreads; t++) {
+		/* a pool is tied to its fd, so pooled sessions share it */
+		s[t].fd = flags & (SHARED_FD | USE_POOL) ?
+			fd : drm_open_driver(DRIVER_INTEL);
+		s[t].flags = flags;
+		s[t].timeout = timeout;
+		s[t].pool = pool;
+		s[t].max_samples = max_samples;
+		s[t].samples = calloc(max_samples, sizeof(uint64_t));
+		assert(s[t].samples);
+	}
+	for (unsigned t = 0; t < nthreads; t++)
+		assert(pthread_create(&s[t].thread, NULL,
+				      session_thread, &s[t]) == 0);
+
+	all = calloc(nthreads * max_samples, sizeof(*all));
+	assert(all);
+	for (unsigned t = 0; t < nthreads; t++) {
+		unsigned n;
+
+		pthread_join(s[t].thread, NULL);
+		n = s[t].count < max_samples ? s[t].count : max_samples;
+		memcpy(all + nsamples, s[t].samples, n * sizeof(*all));
+		nsamples += n;
+		total += s[t].count;
+
+		if (s[t].fd != fd)
+			close(s[t].fd);
+		free(s[t].samples);
+	}
+	sort_u64(all, nsamples);
+
+	printf("  %7u %12.0f %12.2f %12.2f %12.2f\n", nthreads,
+	       (double)total / timeout,
+	       percentile_u64(all, nsamples, 50) / 1000.0,
+	       percentile_u64(all, nsamples, 99) / 1000.0,
+	       nsamples ? all[nsamples - 1] / 1000.0 : 0);
+	fflush(stdout);
+
+	if (pool)
+		gem_context_pool_destroy(pool);
+	free(all);
+	free(s);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n max-contexts] [-t max-threads] [-d seconds] [-s]\n"
+	       "  -n  sweep live contexts from 1 to max-contexts (default 4096)\n"
+	       "  -t  sweep session threads from 1 to max-threads (default 8)\n"
+	       "  -d  duration of each session run (default 2)\n"
+	       "  -s  unpooled session threads share one fd\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned max_contexts = 4096, max_threads = 8;
+	unsigned flags = 0;
+	int timeout = 2;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "n:t:d:sh")) != -1) {
+		switch (c) {
+		case 'n':
+			max_contexts = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'd':
+			timeout = atoi(optarg);
+			break;
+		case 's':
+			flags |= SHARED_FD;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!max_contexts || !max_threads || timeout < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	printf("Per context cost with N live contexts:\n");
+	printf("  %6s %12s %12s %12s %12s\n", "live",
+	       "create(us)", "1st-exec(us)", "2nd-exec(us)", "destroy(us)");
+	for (unsigned n = 1; n <= max_contexts; n <<= 2)
+		live_contexts(fd, n);
+
+	printf("\nSession churn, create + execbuf + destroy:\n");
+	printf("  %7s %12s %12s %12s %12s\n", "threads",
+	       "sessions/s", "p50(us)", "p99(us)", "max(us)");
+	for (unsigned t = 1; t <= max_threads; t <<= 1)
+		sessions(fd, t, flags, timeout);
+
+	printf("\nSession churn, pool get + execbuf + put:\n");
+	printf("  %7s %12s %12s %12s %12s\n", "threads",
+	       "sessions/s", "p50(us)", "p99(us)", "max(us)");
+	for (unsigned t = 1; t <= max_threads; t <<= 1)
+		sessions(fd, t, flags | USE_POOL, timeout);
+
+	close(fd);
+	return 0;
+}
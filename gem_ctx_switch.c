@@ -0,0 +1,367 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Context switch ping-pong: a chain of tiny batches is bounced between N
+ * contexts, each batch waiting on the out-fence of the previous one. The
+ * chain is held back by a spinning plug until fully queued, then released,
+ * and the completion of every link is timestamped by polling its fence. The
+ * interval between two completions is the cost of one switch.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+#include "intel_reg.h"
+
+#define CHAIN_LENGTH 256
+#define MAX_CONTEXTS 64
+#define HIST_BUCKETS 16
+
+#define PRIO_MIXED 0x1
+#define CROSS_ENGINE 0x2
+
+static const unsigned engines[] = { I915_EXEC_RENDER, I915_EXEC_BLT };
+
+/* Engine busy, wait and sema time and the gpu state, read as one group */
+static struct pmu_group pmu;
+
+struct plug {
+	uint32_t handle;
+	uint32_t *batch;
+	int fence;
+};
+
+/* A self-referencing batch that spins until plug_release() */
+static void plug_insert(int fd, struct plug *plug, unsigned ring)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj;
+	struct drm_i915_gem_relocation_entry reloc;
+	int i;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.handle = gem_create(fd, 4096);
+	obj.relocs_ptr = (uint64_t)&reloc;
+	obj.relocation_count = 1;
+
+	plug->handle = obj.handle;
+	plug->batch = gem_mmap__wc(fd, obj.handle, 0, 4096, PROT_WRITE);
+	gem_set_domain(fd, obj.handle,
+		       I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+
+	memset(&reloc, 0, sizeof(reloc));
+	reloc.target_handle = obj.handle; /* recurse */
+	reloc.offset = sizeof(uint32_t);
+	reloc.read_domains = I915_GEM_DOMAIN_COMMAND;
+
+	i = 0;
+	plug->batch[i] = MI_BATCH_BUFFER_START;
+	plug->batch[i] |= 1 << 8 | 1;
+	plug->batch[++i] = 0;
+	plug->batch[++i] = 0;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&obj;
+	execbuf.buffer_count = 1;
+	execbuf.flags = ring | I915_EXEC_FENCE_OUT;
+	execbuf.rsvd2 = -1;
+	gem_execbuf_wr(fd, &execbuf);
+
+	plug->fence = execbuf.rsvd2 >> 32;
+	assert(plug->fence != -1);
+}
+
+static void plug_release(int fd, struct plug *plug)
+{
+	*plug->batch = MI_BATCH_BUFFER_END;
+	__sync_synchronize();
+}
+
+static void plug_fini(int fd, struct plug *plug)
+{
+	gem_sync(fd, plug->handle);
+	munmap(plug->batch, 4096);
+	gem_close(fd, plug->handle);
+	close(plug->fence);
+}
+
+/*
+ * Run one chain over @nctx contexts and store the CHAIN_LENGTH - 1 switch
+ * intervals in @switches.
+ */
+static void pingpong(int fd, uint32_t *ctx, unsigned nctx,
+		     unsigned flags, uint64_t *switches)
+{
+	const uint32_t bbe = MI_BATCH_BUFFER_END;
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj;
+	uint64_t done[CHAIN_LENGTH];
+	int fences[CHAIN_LENGTH];
+	struct timespec start;
+	struct plug plug;
+	int in;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.handle = gem_create(fd, 4096);
+	gem_write(fd, obj.handle, 0, &bbe, sizeof(bbe));
+
+	plug_insert(fd, &plug, engines[0]);
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&obj;
+	execbuf.buffer_count = 1;
+
+	in = plug.fence;
+	for (unsigned n = 0; n < CHAIN_LENGTH; n++) {
+		unsigned ring = engines[0];
+
+		if (flags & CROSS_ENGINE)
+			ring = engines[n % (sizeof(engines)/sizeof(engines[0]))];
+
+		execbuf.flags = ring | I915_EXEC_FENCE_IN | I915_EXEC_FENCE_OUT;
+		execbuf.rsvd1 = ctx[n % nctx];
+		execbuf.rsvd2 = in;
+		gem_execbuf_wr(fd, &execbuf);
+
+		fences[n] = execbuf.rsvd2 >> 32;
+		assert(fences[n] != -1);
+		in = fences[n];
+	}
+
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	plug_release(fd, &plug);
+	for (unsigned n = 0; n < CHAIN_LENGTH; n++) {
+		while (fence_busy(fences[n]))
+			assert(seconds_elapsed(&start) < 10);
+		done[n] = nsec_elapsed(&start);
+	}
+
+	for (unsigned n = 1; n < CHAIN_LENGTH; n++)
+		switches[n - 1] = done[n] - done[n - 1];
+
+	for (unsigned n = 0; n < CHAIN_LENGTH; n++)
+		close(fences[n]);
+	plug_fini(fd, &plug);
+	gem_sync(fd, obj.handle);
+	gem_close(fd, obj.handle);
+}
+
+static void print_histogram(const uint64_t *sorted, unsigned count)
+{
+	unsigned hist[HIST_BUCKETS] = {};
+	unsigned max = 0;
+
+	/* power-of-two buckets starting at 1us */
+	for (unsigned n = 0; n < count; n++) {
+		uint64_t us = sorted[n] / 1000;
+		unsigned b = 0;
+
+		while (us > 1 && b < HIST_BUCKETS - 1) {
+			us >>= 1;
+			b++;
+		}
+		hist[b]++;
+		if (hist[b] > max)
+			max = hist[b];
+	}
+
+	for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+
+		printf("    %6u-%-6uus %6u ", b ? 1u << b : 0, 2u << b, hist[b]);
+		for (unsigned n = 0; n < 40 * hist[b] / max; n++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+/*
+ * Every PMU event that moved while the passes ran. A chain that leaves the
+ * engine idle between links is bound by the cpu side of each switch.
+ */
+static void print_utilisation(const struct pmu_sample *start,
+			      const struct pmu_sample *end)
+{
+	double rates[PMU_MAX_EVENTS];
+	const char *sep = "    ";
+
+	pmu_group_rates(&pmu, start, end, rates);
+	for (unsigned i = 0; i < pmu.nevent; i++) {
+		const char *name = pmu.event[i].name;
+
+		if (!(rates[i] > 0))
+			continue;
+
+		/* everything but the frequencies and interrupts is ns/s */
+		if (strstr(name, "frequency"))
+			printf("%s%s %.0fMHz", sep, name, rates[i]);
+		else if (!strcmp(name, "interrupts"))
+			printf("%s%s %.0f/s", sep, name, rates[i]);
+		else
+			printf("%s%s %.1f%%", sep, name, rates[i] / 1e7);
+		sep = ", ";
+	}
+	printf("\n");
+}
+
+/* Doubles the number of contexts, ending on max_contexts itself */
+static unsigned next_count(unsigned nctx, unsigned max_contexts)
+{
+	if (nctx < max_contexts && 2 * nctx > max_contexts)
+		return max_contexts;
+
+	return 2 * nctx;
+}
+
+static void run(int fd, unsigned max_contexts, unsigned flags, int passes)
+{
+	uint64_t *switches;
+	unsigned count = passes * (CHAIN_LENGTH - 1);
+	uint32_t ctx[MAX_CONTEXTS];
+
+	switches = calloc(count, sizeof(*switches));
+	assert(switches);
+
+	printf("%s priorities%s:\n",
+	       flags & PRIO_MIXED ? "mixed" : "equal",
+	       flags & CROSS_ENGINE ? ", alternating rcs0/bcs0" : "");
+	printf("  %4s %10s %10s %10s %10s\n",
+	       "ctx", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+
+	for (unsigned nctx = 1; nctx <= max_contexts;
+	     nctx = next_count(nctx, max_contexts)) {
+		struct pmu_sample busy[2];
+		uint64_t total = 0;
+
+		for (unsigned n = 0; n < nctx; n++) {
+			int prio = LOCAL_I915_CONTEXT_DEFAULT_PRIORITY;
+
+			if (flags & PRIO_MIXED)
+				prio = n & 1 ?
+					LOCAL_I915_CONTEXT_MAX_USER_PRIORITY :
+					LOCAL_I915_CONTEXT_MIN_USER_PRIORITY;
+
+			ctx[n] = gem_context_create(fd);
+			__gem_context_set_priority(fd, ctx[n], prio);
+		}
+
+		/* warm up the contexts before sampling */
+		pingpong(fd, ctx, nctx, flags, switches);
+		if (pmu.nevent)
+			assert(pmu_group_read(&pmu, &busy[0]) == 0);
+		for (int p = 0; p < passes; p++)
+			pingpong(fd, ctx, nctx, flags,
+				 switches + p * (CHAIN_LENGTH - 1));
+		if (pmu.nevent)
+			assert(pmu_group_read(&pmu, &busy[1]) == 0);
+
+		for (unsigned n = 0; n < count; n++)
+			total += switches[n];
+		sort_u64(switches, count);
+
+		printf("  %4u %10.2f %10.2f %10.2f %10.2f%s\n", nctx,
+		       total / count / 1000.0,
+		       percentile_u64(switches, count, 50) / 1000.0,
+		       percentile_u64(switches, count, 99) / 1000.0,
+		       switches[count - 1] / 1000.0,
+		       nctx == 1 ? " (no switch)" : "");
+		if (pmu.nevent)
+			print_utilisation(&busy[0], &busy[1]);
+		print_histogram(switches, count);
+		fflush(stdout);
+
+		for (unsigned n = 0; n < nctx; n++)
+			gem_context_destroy(fd, ctx[n]);
+	}
+
+	free(switches);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n max-contexts] [-r passes] [-p] [-e] [-u]\n"
+	       "  -n  ping-pong between 1, 2, 4 .. max-contexts (default 8, max %d)\n"
+	       "  -r  chains of %d batches sampled per context count (default 4)\n"
+	       "  -p  also run with alternating min/max context priorities\n"
+	       "  -e  also run with the chain alternating between rcs0 and bcs0\n"
+	       "  -u  report engine utilisation from the i915 PMU for each row\n",
+	       name, MAX_CONTEXTS, CHAIN_LENGTH);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned max_contexts = 8;
+	bool prio = false, cross = false, utilisation = false;
+	int passes = 4;
+	int fd, c, err;
+
+	while ((c = getopt(argc, argv, "n:r:peuh")) != -1) {
+		switch (c) {
+		case 'n':
+			max_contexts = atoi(optarg);
+			break;
+		case 'r':
+			passes = atoi(optarg);
+			break;
+		case 'p':
+			prio = true;
+			break;
+		case 'e':
+			cross = true;
+			break;
+		case 'u':
+			utilisation = true;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (max_contexts < 1 || max_contexts > MAX_CONTEXTS || passes < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	pmu_group_init(&pmu);
+	if (utilisation) {
+		err = pmu_group_add_all(&pmu);
+		if (err < 0)
+			printf("No i915 PMU: %s\n", strerror(-err));
+	}
+
+	run(fd, max_contexts, 0, passes);
+	if (prio)
+		run(fd, max_contexts, PRIO_MIXED, passes);
+	if (cross)
+		run(fd, max_contexts, CROSS_ENGINE, passes);
+	if (prio && cross)
+		run(fd, max_contexts, PRIO_MIXED | CROSS_ENGINE, passes);
+
+	pmu_group_close(&pmu);
+	close(fd);
+	return 0;
+}
@@ -22,9 +22,12 @@
  *
  */
 #include <inttypes.h>
+#include <getopt.h>
+#include <math.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include "gkit_lib.h"
+#include "intel_reg.h"
 
 #define OBJECT_SIZE 16384
 
@@ -32,83 +35,91 @@
 #define BLT_WRITE_ALPHA		(1<<21)
 #define BLT_WRITE_RGB		(1<<20)
 
+/*
+ * Copies of more than BLT_MAX_ROWS rows are split into several commands,
+ * each relocated to start at row 0.
+ */
+static unsigned linear_blt_commands(uint64_t length, uint32_t pitch)
+{
+	uint64_t rows = length / pitch;
+
+	return (rows + BLT_MAX_ROWS - 1) / BLT_MAX_ROWS + !!(length % pitch);
+}
+
+static uint32_t *emit_copy(uint32_t *b, uint32_t src, uint32_t dst,
+			   uint64_t src_offset, uint64_t dst_offset,
+			   uint32_t pitch,
+			   uint32_t rows, uint32_t width,
+			   struct drm_i915_gem_relocation_entry **reloc,
+			   const uint32_t *batch)
+{
+	struct drm_i915_gem_relocation_entry *r = *reloc;
+	int i = 0;
+
+	b[i++] = COPY_BLT_CMD | BLT_WRITE_ALPHA | BLT_WRITE_RGB;
+	b[i-1]+=2;
+	b[i++] = 0xcc << 16 | 1 << 25 | 1 << 24 | pitch;
+	b[i++] = 0;
+	b[i++] = rows << 16 | (width / 4);
+	r->offset = (b-batch+i) * sizeof(uint32_t);
+	r->delta = dst_offset;
+	r->target_handle = dst;
+	r->read_domains = I915_GEM_DOMAIN_RENDER;
+	r->write_domain = I915_GEM_DOMAIN_RENDER;
+	r->presumed_offset = 0;
+	r++;
+	b[i++] = dst_offset;
+	b[i++] = dst_offset >> 32;
+
+	b[i++] = 0;
+	b[i++] = pitch;
+	r->offset = (b-batch+i) * sizeof(uint32_t);
+	r->delta = src_offset;
+	r->target_handle = src;
+	r->read_domains = I915_GEM_DOMAIN_RENDER;
+	r->write_domain = 0;
+	r->presumed_offset = 0;
+	r++;
+	b[i++] = src_offset;
+	b[i++] = src_offset >> 32;
+
+	*reloc = r;
+	return b + i;
+}
+
+/*
+ * Copy @length bytes from @src to @dst @repeat times over, as rows of @pitch
+ * bytes followed by a partial row for the remainder. Returns the length of
+ * the batch; two relocations per linear_blt_commands() are written to @reloc.
+ */
 static int gem_linear_blt(int fd,
 			  uint32_t *batch,
 			  uint32_t src,
 			  uint32_t dst,
-			  uint32_t length,
+			  uint64_t length,
+			  uint32_t pitch,
+			  unsigned repeat,
 			  struct drm_i915_gem_relocation_entry *reloc)
 {
 	uint32_t *b = batch;
-	int height = length / (16 * 1024);
-
-	assert(height <= (1 << 16));
-
-	if (height) {
-		int i = 0;
-		b[i++] = COPY_BLT_CMD | BLT_WRITE_ALPHA | BLT_WRITE_RGB;
-		b[i-1]+=2;
-		b[i++] = 0xcc << 16 | 1 << 25 | 1 << 24 | (16*1024);
-		b[i++] = 0;
-		b[i++] = height << 16 | (4*1024);
-		b[i++] = 0;
-		reloc->offset = (b-batch+4) * sizeof(uint32_t);
-		reloc->delta = 0;
-		reloc->target_handle = dst;
-		reloc->read_domains = I915_GEM_DOMAIN_RENDER;
-		reloc->write_domain = I915_GEM_DOMAIN_RENDER;
-		reloc->presumed_offset = 0;
-		reloc++;
-		b[i++] = 0;
-
-		b[i++] = 0;
-		b[i++] = 16*1024;
-		b[i++] = 0;
-		reloc->offset = (b-batch+7) * sizeof(uint32_t);
-		reloc->offset += sizeof(uint32_t);
-		reloc->delta = 0;
-		reloc->target_handle = src;
-		reloc->read_domains = I915_GEM_DOMAIN_RENDER;
-		reloc->write_domain = 0;
-		reloc->presumed_offset = 0;
-		reloc++;
-		b[i++] = 0;
-
-		b += i;
-		length -= height * 16*1024;
-	}
 
-	if (length) {
-		int i = 0;
-		b[i++] = COPY_BLT_CMD | BLT_WRITE_ALPHA | BLT_WRITE_RGB;
-		b[i-1]+=2;
-		b[i++] = 0xcc << 16 | 1 << 25 | 1 << 24 | (16*1024);
-		b[i++] = height << 16;
-		b[i++] = (1+height) << 16 | (length / 4);
-		b[i++] = 0;
-		reloc->offset = (b-batch+4) * sizeof(uint32_t);
-		reloc->delta = 0;
-		reloc->target_handle = dst;
-		reloc->read_domains = I915_GEM_DOMAIN_RENDER;
-		reloc->write_domain = I915_GEM_DOMAIN_RENDER;
-		reloc->presumed_offset = 0;
-		reloc++;
-		b[i++] = 0;
-
-		b[i++] = height << 16;
-		b[i++] = 16*1024;
-		b[i++] = 0;
-		reloc->offset = (b-batch+7) * sizeof(uint32_t);
-		reloc->offset += sizeof(uint32_t);
-		reloc->delta = 0;
-		reloc->target_handle = src;
-		reloc->read_domains = I915_GEM_DOMAIN_RENDER;
-		reloc->write_domain = 0;
-		reloc->presumed_offset = 0;
-		reloc++;
-		b[i++] = 0;
-
-		b += i;
+	assert(length % 4 == 0 && pitch % 4 == 0 && pitch < 1 << 15);
+
+	for (unsigned n = 0; n < repeat; n++) {
+		uint64_t rows = length / pitch, offset = 0;
+
+		while (rows) {
+			uint32_t chunk = rows < BLT_MAX_ROWS ? rows : BLT_MAX_ROWS;
+
+			b = emit_copy(b, src, dst, offset, offset, pitch,
+				      chunk, pitch, &reloc, batch);
+			offset += (uint64_t)chunk * pitch;
+			rows -= chunk;
+		}
+
+		if (length % pitch)
+			b = emit_copy(b, src, dst, offset, offset, pitch,
+				      1, length % pitch, &reloc, batch);
 	}
 
 	b[0] = MI_BATCH_BUFFER_END;
@@ -117,6 +128,149 @@ static int gem_linear_blt(int fd,
 	return (b+2 - batch) * sizeof(uint32_t);
 }
 
+#define TELEMETRY_INTERVAL_US 1000
+/* A minute of history at the interval above */
+#define TELEMETRY_SAMPLES (1 << 16)
+
+/* Frequency, rc6 and blitter busyness while each result was measured */
+static struct {
+	bool enabled;
+	struct sampler sampler;
+	struct sysfs_dir sysfs;
+	int act, rc6, busy;
+} telemetry;
+
+static void telemetry_init(const char *root)
+{
+	if (sysfs_open(&telemetry.sysfs, root) ||
+	    sampler_init(&telemetry.sampler, TELEMETRY_SAMPLES,
+			 TELEMETRY_INTERVAL_US)) {
+		printf("No telemetry\n");
+		return;
+	}
+
+	telemetry.act = sampler_add_sysfs(&telemetry.sampler, &telemetry.sysfs,
+					  "gt_act_freq_mhz", SAMPLER_GAUGE);
+	telemetry.rc6 = sampler_add_sysfs(&telemetry.sampler, &telemetry.sysfs,
+					  "power/rc6_residency_ms",
+					  SAMPLER_COUNTER);
+	telemetry.busy = sampler_add_pmu(&telemetry.sampler, "bcs-busy",
+					 LOCAL_I915_PMU_ENGINE(LOCAL_I915_ENGINE_CLASS_COPY,
+							       0, LOCAL_I915_SAMPLE_BUSY));
+	assert(sampler_start(&telemetry.sampler) == 0);
+	telemetry.enabled = true;
+}
+
+static void telemetry_fini(void)
+{
+	if (!telemetry.enabled)
+		return;
+
+	sampler_fini(&telemetry.sampler);
+	sysfs_close(&telemetry.sysfs);
+}
+
+static void telemetry_header(void)
+{
+	if (telemetry.enabled)
+		printf(" %8s %6s %6s", "act(MHz)", "rc6%", "busy%");
+}
+
+static void telemetry_column(int channel, const double *v, double scale,
+			     int width, int precision)
+{
+	if (channel < 0 || isnan(v[channel]))
+		printf(" %*s", width, "-");
+	else
+		printf(" %*.*f", width, precision, v[channel] * scale);
+}
+
+/* rc6 residency is in ms per second, engine busyness in ns per second */
+static void telemetry_columns(uint64_t start, uint64_t end)
+{
+	double v[SAMPLER_MAX_CHANNELS];
+
+	if (!telemetry.enabled)
+		return;
+
+	if (!sampler_summary(&telemetry.sampler, start, end, v)) {
+		printf(" %8s %6s %6s", "-", "-", "-");
+		return;
+	}
+
+	telemetry_column(telemetry.act, v, 1, 8, 0);
+	telemetry_column(telemetry.rc6, v, 1e-1, 6, 1);
+	telemetry_column(telemetry.busy, v, 1e-7, 6, 1);
+}
+
+/* RAPL energy used while each result was measured */
+static struct {
+	bool enabled;
+	struct energy energy;
+	int gt;
+} power;
+
+static void power_init(const char *root)
+{
+	int err = energy_open(&power.energy, root);
+
+	if (err) {
+		printf("No energy counters: %s\n", strerror(-err));
+		return;
+	}
+
+	power.gt = energy_domain(&power.energy, "uncore");
+	power.enabled = true;
+}
+
+static void power_fini(void)
+{
+	if (power.enabled)
+		energy_close(&power.energy);
+}
+
+static void power_begin(uint64_t *uj)
+{
+	if (power.enabled)
+		assert(energy_read(&power.energy, uj) == 0);
+}
+
+/* Returns the package joules used since power_begin(), 0 without counters */
+static double power_end(const uint64_t *start, double *joules)
+{
+	uint64_t end[ENERGY_MAX_DOMAINS];
+
+	if (!power.enabled)
+		return 0;
+
+	assert(energy_read(&power.energy, end) == 0);
+	return energy_joules(&power.energy, start, end, joules);
+}
+
+static void power_header(const char *unit)
+{
+	if (!power.enabled)
+		return;
+
+	printf(" %8s", "pkg(W)");
+	if (power.gt >= 0)
+		printf(" %8s", "gt(W)");
+	printf(" %8s", unit);
+}
+
+/* Average power over @ns, and the energy spent on each of @units */
+static void power_columns(double package, const double *joules,
+			  uint64_t ns, double units)
+{
+	if (!power.enabled)
+		return;
+
+	printf(" %8.2f", package * 1e9 / ns);
+	if (power.gt >= 0)
+		printf(" %8.2f", joules[power.gt] * 1e9 / ns);
+	printf(" %8.3f", package / units);
+}
+
 static double elapsed(const struct timeval *start,
 		      const struct timeval *end)
 {
@@ -154,24 +308,44 @@ static int dcmp(const void *A, const void *B)
 		return 0;
 }
 
-static void run(int object_size)
+#define TARGET_BYTES (4ull << 30)
+#define MAX_LOOPS (1 << 12)
+#define LATENCY_SAMPLES 16
+
+/*
+ * Blit @object_size bytes at @pitch, @per_batch times in every batch. The
+ * latency is the median of single batches submitted to an idle engine and
+ * waited upon, per blit; the throughput comes from a queue of back to back
+ * batches, as does the energy. Returns the joules per GB blitted, 0 without
+ * energy counters.
+ */
+static double run(uint64_t object_size, uint32_t pitch, unsigned per_batch,
+		bool table)
 {
 	struct drm_i915_gem_execbuffer2 execbuf;
 	struct drm_i915_gem_exec_object2 exec[3];
-	struct drm_i915_gem_relocation_entry reloc[4];
-	uint32_t buf[20];
-	uint32_t handle, src, dst;
-	int fd, len, count;
+	struct drm_i915_gem_relocation_entry *reloc;
+	uint64_t latency[LATENCY_SAMPLES];
+	uint32_t *buf, handle, src, dst;
+	unsigned nreloc, loops, samples;
+	uint64_t batch_size, total;
+	int fd, len;
 	int ring;
 
 	fd = drm_open_driver(DRIVER_INTEL);
 
-	handle = gem_create(fd, 4096);
+	nreloc = 2 * per_batch * linear_blt_commands(object_size, pitch);
+	batch_size = ((nreloc / 2 * 10 + 2) * sizeof(uint32_t) + 4095) & -4096;
+	buf = malloc(batch_size);
+	reloc = calloc(nreloc, sizeof(*reloc));
+	assert(buf && reloc);
 
+	handle = gem_create(fd, batch_size);
 	src = gem_create(fd, object_size);
 	dst = gem_create(fd, object_size);
 
-	len = gem_linear_blt(fd, buf, 0, 1, object_size, reloc);
+	/* with HANDLE_LUT the relocations target the index into exec[] */
+	len = gem_linear_blt(fd, buf, 0, 1, object_size, pitch, per_batch, reloc);
 	gem_write(fd, handle, 0, buf, len);
 
 	memset(exec, 0, sizeof(exec));
@@ -179,7 +353,7 @@ static void run(int object_size)
 	exec[1].handle = dst;
 
 	exec[2].handle = handle;
-	exec[2].relocation_count = len > 56 ? 4 : 2;
+	exec[2].relocation_count = nreloc;
 	exec[2].relocs_ptr = (uint64_t)reloc;
 
 	ring = I915_EXEC_BLT;
@@ -190,128 +364,755 @@ static void run(int object_size)
 	execbuf.batch_len = len;
 	execbuf.flags = ring;
 	execbuf.flags |= I915_EXEC_HANDLE_LUT;
+
+	gem_execbuf(fd, &execbuf);
+	gem_sync(fd, handle);
+	/* everything is now bound where the relocations say */
 	execbuf.flags |= I915_EXEC_NO_RELOC;
 
-	if (__gem_execbuf(fd, &execbuf)) {
-		len = gem_linear_blt(fd, buf, src, dst, object_size, reloc);
-		assert(len == execbuf.batch_len);
-		gem_write(fd, handle, 0, buf, len);
-		execbuf.flags = ring;
+	loops = TARGET_BYTES / (object_size * per_batch);
+	if (loops < 1)
+		loops = 1;
+	if (loops > MAX_LOOPS)
+		loops = MAX_LOOPS;
+	samples = loops < LATENCY_SAMPLES ? loops : LATENCY_SAMPLES;
+
+	for (unsigned n = 0; n < samples; n++) {
+		struct timespec t = {};
+
+		nsec_elapsed(&t);
 		gem_execbuf(fd, &execbuf);
+		gem_sync(fd, handle);
+		latency[n] = nsec_elapsed(&t);
 	}
-	gem_sync(fd, handle);
+	sort_u64(latency, samples);
 
 	struct timeval start, end;
+	uint64_t window = sampler_now();
+	uint64_t energy[ENERGY_MAX_DOMAINS];
+	double joules[ENERGY_MAX_DOMAINS], package;
 
+	power_begin(energy);
 	gettimeofday(&start, NULL);
-	for (int loop = 0; loop < 1<<12; loop++)
+	for (unsigned loop = 0; loop < loops; loop++)
 		gem_execbuf(fd, &execbuf);
 	gem_sync(fd, handle);
 	gettimeofday(&end, NULL);
+	package = power_end(energy, joules);
 	double duration = elapsed(&start, &end);
-	printf("Time to blt %d bytes:	%7.3fµs, %s\n",
-		 object_size, duration,
-		 bytes_per_sec((char *)buf, object_size/duration*1e6));
+
+	total = (uint64_t)loops * per_batch * object_size;
+	if (table)
+		printf("%10lu %6u %6u %12.3f %12.3f %10.2f",
+		       (unsigned long)(object_size >> 10), pitch, per_batch,
+		       percentile_u64(latency, samples, 50) / 1000.0 / per_batch,
+		       duration / loops / per_batch,
+		       total / duration / 1e3);
+	else
+		printf("Time to blt %lu bytes:	%7.3fµs, %s",
+		       (unsigned long)object_size, duration / loops / per_batch,
+		       bytes_per_sec((char *)buf, total / duration * 1e6));
+	telemetry_columns(window, sampler_now());
+	power_columns(package, joules, duration * 1e3, total / 1e9);
+	printf("\n");
 	fflush(stdout);
+	gem_close(fd, src);
+	gem_close(fd, dst);
 	gem_close(fd, handle);
+	free(reloc);
+	free(buf);
 	close(fd);
+
+	return package * 1e9 / total;
 }
 
-static int sysfs_read(const char *name)
+static void sweep(uint64_t max_size)
 {
-	char buf[4096];
-	int sysfd;
-	int len;
+	static const uint32_t pitches[] = { 1024, 4096, 16384 };
+	static const unsigned per_batch[] = { 1, 4, 16 };
 
-	sprintf(buf, "/sys/class/drm/card%d/%s",
-		drm_get_card(), name);
-	sysfd = open(buf, O_RDONLY);
-	if (sysfd < 0)
-		return -1;
+	printf("%10s %6s %6s %12s %12s %10s", "size(KiB)", "pitch",
+	       "blits", "latency(us)", "blit(us)", "GB/s");
+	telemetry_header();
+	power_header("J/GB");
+	printf("\n");
+	for (uint64_t size = 4096; size <= max_size; size <<= 2)
+		for (unsigned p = 0; p < sizeof(pitches) / sizeof(pitches[0]); p++)
+			for (unsigned k = 0; k < sizeof(per_batch) / sizeof(per_batch[0]); k++)
+				run(size, pitches[p], per_batch[k], true);
+}
 
-	len = read(sysfd, buf, sizeof(buf)-1);
-	close(sysfd);
-	if (len < 0)
-		return -1;
+#define FRAME_PITCH 16384
+/* One blit, MI_BATCH_BUFFER_END and padding, rounded up to a cacheline */
+#define SEPARATE_STRIDE 64
+
+/*
+ * A frame of @count small copies of @size bytes, the i'th writing region i of
+ * exec[1]. Independent copies read region i of exec[0]; dependent ones read
+ * the region the previous copy wrote, so an MI_FLUSH_DW has to land that
+ * write before the next blit may read it. With @stride every copy is a batch
+ * of its own, @stride bytes apart, and the kernel flushes between them.
+ */
+static int frame_blt(uint32_t *batch, unsigned count, uint32_t size,
+		     bool dependent, unsigned stride,
+		     struct drm_i915_gem_relocation_entry *reloc)
+{
+	uint32_t pitch = size < FRAME_PITCH ? size : FRAME_PITCH;
+	uint32_t *b = batch;
+
+	for (unsigned i = 0; i < count; i++) {
+		uint64_t dst = (uint64_t)i * size;
+		bool chained = dependent && i;
+
+		if (stride) {
+			b = batch + i * stride / sizeof(uint32_t);
+		} else if (chained) {
+			*b++ = MI_FLUSH_DW | 2;
+			*b++ = 0;
+			*b++ = 0;
+			*b++ = 0;
+		}
+
+		b = emit_copy(b, chained, 1, chained ? dst - size : dst, dst,
+			      pitch, size / pitch, pitch, &reloc, batch);
+		if (stride)
+			*b++ = MI_BATCH_BUFFER_END;
+	}
+
+	if (!stride)
+		*b++ = MI_BATCH_BUFFER_END;
+	if ((b - batch) & 1)
+		*b++ = 0;
 
-	buf[len] = '\0';
-	return atoi(buf);
+	return (b - batch) * sizeof(uint32_t);
 }
 
-static int sysfs_write(const char *name, int value)
+struct frame {
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 exec[3];
+	struct drm_i915_gem_relocation_entry *reloc;
+	unsigned count, stride;
+};
+
+static void frame_init(int fd, struct frame *f, uint32_t src, uint32_t dst,
+		       unsigned count, uint32_t size, bool dependent,
+		       unsigned stride)
 {
-	char buf[4096];
-	int sysfd;
+	uint32_t *buf;
+	uint64_t batch_size;
 	int len;
 
-	sprintf(buf, "/sys/class/drm/card%d/%s",
-		drm_get_card(), name);
-	sysfd = open(buf, O_WRONLY);
-	if (sysfd < 0)
-		return -1;
+	memset(f, 0, sizeof(*f));
+	f->count = count;
+	f->stride = stride;
 
-	len = sprintf(buf, "%d", value);
-	len = write(sysfd, buf, len);
-	close(sysfd);
+	/* a blit is 10 dwords and a flush 4, plus the terminator */
+	batch_size = stride ? count * stride : (count * 14 + 2) * sizeof(uint32_t);
+	batch_size = (batch_size + 4095) & -4096;
+	buf = calloc(1, batch_size);
+	f->reloc = calloc(2 * count, sizeof(*f->reloc));
+	assert(buf && f->reloc);
 
-	if (len < 0)
-		return len;
+	len = frame_blt(buf, count, size, dependent, stride, f->reloc);
 
-	return 0;
+	f->exec[0].handle = src;
+	f->exec[1].handle = dst;
+	f->exec[2].handle = gem_create(fd, batch_size);
+	f->exec[2].relocation_count = 2 * count;
+	f->exec[2].relocs_ptr = (uint64_t)f->reloc;
+	gem_write(fd, f->exec[2].handle, 0, buf, len);
+	free(buf);
+
+	f->execbuf.buffers_ptr = (uint64_t)f->exec;
+	f->execbuf.buffer_count = 3;
+	f->execbuf.batch_len = stride ?: len;
+	f->execbuf.flags = I915_EXEC_BLT | I915_EXEC_HANDLE_LUT;
+
+	/* the first execbuf applies every relocation, whatever batch it runs */
+	gem_execbuf(fd, &f->execbuf);
+	gem_sync(fd, f->exec[2].handle);
+	f->execbuf.flags |= I915_EXEC_NO_RELOC;
 }
 
-static void set_auto_freq(void)
+static void frame_submit(int fd, struct frame *f)
 {
-	int min = sysfs_read("gt_RPn_freq_mhz");
-	int max = sysfs_read("gt_RP0_freq_mhz");
-	if (max <= min)
+	if (!f->stride) {
+		gem_execbuf(fd, &f->execbuf);
 		return;
+	}
 
-	printf("Setting to %d-%dMHz auto\n", min, max);
-	sysfs_write("gt_min_freq_mhz", min);
-	sysfs_write("gt_max_freq_mhz", max);
+	for (unsigned i = 0; i < f->count; i++) {
+		f->execbuf.batch_start_offset = i * f->stride;
+		gem_execbuf(fd, &f->execbuf);
+	}
 }
 
-static void set_min_freq(void)
+/*
+ * Returns the median time for a whole frame on an idle engine, and in
+ * @blit_ns and @blit_uj the time and package energy per copy when frames
+ * are queued back to back.
+ */
+static uint64_t frame_measure(int fd, struct frame *f, uint64_t *blit_ns,
+			      double *blit_uj)
 {
-	int min = sysfs_read("gt_RPn_freq_mhz");
-	printf("Setting to %dMHz\n", min);
-	assert(sysfs_write("gt_min_freq_mhz", min) == 0);
-	assert(sysfs_write("gt_max_freq_mhz", min) == 0);
+	uint64_t energy[ENERGY_MAX_DOMAINS];
+	uint64_t latency[LATENCY_SAMPLES];
+	struct timespec start = {};
+	unsigned loops;
+
+	for (unsigned n = 0; n < LATENCY_SAMPLES; n++) {
+		struct timespec t = {};
+
+		nsec_elapsed(&t);
+		frame_submit(fd, f);
+		gem_sync(fd, f->exec[1].handle);
+		latency[n] = nsec_elapsed(&t);
+	}
+	sort_u64(latency, LATENCY_SAMPLES);
+
+	/* the same number of copies for every frame size */
+	loops = MAX_LOOPS / f->count ?: 1;
+	power_begin(energy);
+	nsec_elapsed(&start);
+	for (unsigned n = 0; n < loops; n++)
+		frame_submit(fd, f);
+	gem_sync(fd, f->exec[1].handle);
+	*blit_ns = nsec_elapsed(&start) / loops / f->count;
+	*blit_uj = power_end(energy, NULL) * 1e6 / loops / f->count;
+
+	return percentile_u64(latency, LATENCY_SAMPLES, 50);
 }
 
-static void set_max_freq(void)
+static void frame_fini(int fd, struct frame *f)
 {
-	int max = sysfs_read("gt_RP0_freq_mhz");
-	printf("Setting to %dMHz\n", max);
-	assert(sysfs_write("gt_max_freq_mhz", max) == 0);
-	assert(sysfs_write("gt_min_freq_mhz", max) == 0);
+	gem_close(fd, f->exec[2].handle);
+	free(f->reloc);
 }
 
+#define KNEE_PERCENT 10
 
-int main(int argc, char **argv)
+/*
+ * Frames of 1 to @max_count copies of @size bytes, packed into a single batch
+ * against one execbuf per copy. Batching cuts the cost per copy until the
+ * blitter itself is the bottleneck, but nothing in the frame is visible until
+ * the whole batch completes; the knee is the smallest frame whose cost per
+ * copy is within KNEE_PERCENT of the best seen, past which a bigger batch only
+ * adds latency.
+ */
+static void batched(uint32_t size, unsigned max_count, bool dependent)
 {
-	const struct {
-		const char *suffix;
-		void (*func)(void);
-	} rps[] = {
-		{ "-auto", set_auto_freq },
-		{ "-min", set_min_freq },
-		{ "-max", set_max_freq },
-		{ NULL, NULL },
-	}, *r;
-	int min = -1, max = -1;
-	int i;
-
-	min = sysfs_read("gt_min_freq_mhz");
-	max = sysfs_read("gt_max_freq_mhz");
-
-	for (r = rps; r->suffix; r++) {
-		r->func();
-		run(OBJECT_SIZE);
+	uint64_t best = -1, *blit_ns;
+	unsigned steps = 0, knee = 1;
+	uint32_t src, dst;
+	int fd;
+
+	fd = drm_open_driver(DRIVER_INTEL);
+	src = gem_create(fd, (uint64_t)size * max_count);
+	dst = gem_create(fd, (uint64_t)size * max_count);
+
+	for (unsigned count = 1; count <= max_count; count <<= 1)
+		steps++;
+	blit_ns = calloc(steps, sizeof(*blit_ns));
+	assert(blit_ns);
+
+	printf("%u KiB %s copies\n", size >> 10,
+	       dependent ? "dependent" : "independent");
+	printf("%6s %12s %12s %12s %12s\n", "",
+	       "batched", "", "separate", "");
+	printf("%6s %12s %12s %12s %12s", "blits",
+	       "frame(us)", "blit(us)", "frame(us)", "blit(us)");
+	telemetry_header();
+	if (power.enabled)
+		printf(" %12s %12s", "uJ/blit", "uJ/blit");
+	printf("\n");
+	for (unsigned count = 1, s = 0; count <= max_count; count <<= 1, s++) {
+		uint64_t window = sampler_now();
+		struct frame f;
+		uint64_t frame[2], blit[2];
+		double uj[2];
+
+		frame_init(fd, &f, src, dst, count, size, dependent, 0);
+		frame[0] = frame_measure(fd, &f, &blit[0], &uj[0]);
+		frame_fini(fd, &f);
+
+		frame_init(fd, &f, src, dst, count, size, dependent,
+			   SEPARATE_STRIDE);
+		frame[1] = frame_measure(fd, &f, &blit[1], &uj[1]);
+		frame_fini(fd, &f);
+
+		printf("%6u %12.3f %12.3f %12.3f %12.3f", count,
+		       frame[0] / 1000.0, blit[0] / 1000.0,
+		       frame[1] / 1000.0, blit[1] / 1000.0);
+		telemetry_columns(window, sampler_now());
+		if (power.enabled)
+			printf(" %12.3f %12.3f", uj[0], uj[1]);
 		printf("\n");
+		fflush(stdout);
+
+		blit_ns[s] = blit[0];
+		if (blit[0] < best)
+			best = blit[0];
+	}
+
+	for (unsigned count = 1, s = 0; s < steps; count <<= 1, s++) {
+		if (blit_ns[s] * 100 <= best * (100 + KNEE_PERCENT)) {
+			knee = count;
+			break;
+		}
+	}
+	printf("cost per blit within %d%% of its floor from %u blits per batch\n",
+	       KNEE_PERCENT, knee);
+
+	free(blit_ns);
+	gem_close(fd, src);
+	gem_close(fd, dst);
+	close(fd);
+}
+
+struct subtest {
+	uint64_t max_size;
+	uint32_t frame_size;
+	unsigned max_count;
+	bool sweep;
+	bool dependent;
+	const struct stable_gate *gate;
+	int fd;
+	/* the frequency with the fewest joules per GB in a sweep */
+	int best_mhz;
+	double best_j_per_gb;
+};
+
+/* Returns the ms taken for the gpu to hold steady, or -1 if it did not */
+static double wait_stable(const struct subtest *t)
+{
+	uint64_t waited;
+
+	if (stable_wait(t->gate, t->fd, &waited))
+		return -1;
+	return waited / 1e6;
+}
+
+static void run_subtest(const struct subtest *t)
+{
+	if (t->frame_size)
+		batched(t->frame_size, t->max_count, t->dependent);
+	else if (t->sweep)
+		sweep(t->max_size);
+	else
+		run(OBJECT_SIZE, 16*1024, 1, false);
+}
+
+/* The single copy becomes one row per frequency, anything larger a section */
+static void freq_step(int mhz, int act, void *data)
+{
+	struct subtest *t = data;
+	double stable = t->gate ? wait_stable(t) : 0;
+	double j_per_gb;
+
+	if (t->frame_size || t->sweep) {
+		if (act < 0)
+			printf("%dMHz, not settled", mhz);
+		else
+			printf("%dMHz, running at %dMHz", mhz, act);
+		if (t->gate && stable < 0)
+			printf(", not stable");
+		else if (t->gate)
+			printf(", stable after %.1fms", stable);
+		printf("\n");
+		run_subtest(t);
+		printf("\n");
+		return;
+	}
+
+	printf("%8d ", mhz);
+	if (act < 0)
+		printf("%8s ", "n/a");
+	else
+		printf("%8d ", act);
+	if (t->gate && stable < 0)
+		printf("%10s ", "-");
+	else if (t->gate)
+		printf("%10.1f ", stable);
+	j_per_gb = run(OBJECT_SIZE, 16*1024, 1, true);
+	if (j_per_gb > 0 && (!t->best_mhz || j_per_gb < t->best_j_per_gb)) {
+		t->best_mhz = mhz;
+		t->best_j_per_gb = j_per_gb;
+	}
+}
+
+/* Card attributes of the fake sysfs tree built by -c */
+static const char *fake_attrs[] = {
+	"gt_RPn_freq_mhz", "gt_RP1_freq_mhz", "gt_RP0_freq_mhz",
+	"gt_min_freq_mhz", "gt_max_freq_mhz", "gt_act_freq_mhz",
+};
+
+static void fake_write(const char *dir, const char *name, int64_t value)
+{
+	char path[256];
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	file = fopen(path, "w");
+	assert(file);
+	fprintf(file, "%" PRId64 "\n", value);
+	fclose(file);
+}
+
+static int fake_read(const char *dir, const char *name)
+{
+	char path[256];
+	FILE *file;
+	int value;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	file = fopen(path, "r");
+	assert(file);
+	assert(fscanf(file, "%d", &value) == 1);
+	fclose(file);
+
+	return value;
+}
+
+/*
+ * Swap an attribute for a directory, which cannot be opened for writing even
+ * by root, or swap it back. The open read fd keeps working meanwhile.
+ */
+static void fake_block(const char *dir, const char *name, bool block)
+{
+	char path[256], saved[256];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	snprintf(saved, sizeof(saved), "%s/%s.saved", dir, name);
+	if (block) {
+		assert(rename(path, saved) == 0);
+		assert(mkdir(path, 0700) == 0);
+	} else {
+		assert(rmdir(path) == 0);
+		assert(rename(saved, path) == 0);
 	}
+}
+
+/*
+ * The frequency control against a fake card: the steps from RPn to RP0, the
+ * order of the min and max writes, which the kernel rejects if they would
+ * ever cross, the restore on close and settling without a gpu.
+ */
+static void check_gpu_freq(void)
+{
+	static const int steps[] = { 300, 500, 700, 900, 1100, 1150 };
+	char dir[] = "/tmp/gem_exec_blt.XXXXXX";
+	struct gpu_freq f;
+
+	assert(mkdtemp(dir));
+	fake_write(dir, "gt_RPn_freq_mhz", 300);
+	fake_write(dir, "gt_RP1_freq_mhz", 700);
+	fake_write(dir, "gt_RP0_freq_mhz", 1150);
+	fake_write(dir, "gt_min_freq_mhz", 300);
+	fake_write(dir, "gt_max_freq_mhz", 1100);
+	fake_write(dir, "gt_act_freq_mhz", 300);
+
+	assert(gpu_freq_open(&f, dir, 200) == 0);
+	assert(f.min == 300 && f.max == 1100);
+	assert(f.rpn == 300 && f.rp1 == 700 && f.rp0 == 1150);
+	assert(f.nsteps == sizeof(steps) / sizeof(steps[0]));
+	for (unsigned i = 0; i < f.nsteps; i++)
+		assert(f.steps[i] == steps[i]);
+
+	/* raising min above the current max: max has to be written first */
+	fake_block(dir, "gt_min_freq_mhz", true);
+	assert(gpu_freq_set(&f, 1150, 1150) == -EISDIR);
+	assert(fake_read(dir, "gt_max_freq_mhz") == 1150);
+	fake_block(dir, "gt_min_freq_mhz", false);
+	assert(gpu_freq_set(&f, 1150, 1150) == 0);
+	assert(fake_read(dir, "gt_min_freq_mhz") == 1150);
+
+	/* gt_act_freq_mhz stays at 300 */
+	assert(gpu_freq_settle(&f, -1, 1150, 50) == -ETIMEDOUT);
+	assert(gpu_freq_settle(&f, -1, 300, 1000) == 300);
+
+	gpu_freq_close(&f);
+	assert(fake_read(dir, "gt_min_freq_mhz") == 300);
+	assert(fake_read(dir, "gt_max_freq_mhz") == 1100);
+
+	/* lowering max below the current min: min has to be written first */
+	fake_write(dir, "gt_min_freq_mhz", 900);
+	fake_write(dir, "gt_max_freq_mhz", 900);
+	assert(gpu_freq_open(&f, dir, 0) == 0);
+	fake_block(dir, "gt_max_freq_mhz", true);
+	assert(gpu_freq_set(&f, 500, 500) == -EISDIR);
+	assert(fake_read(dir, "gt_min_freq_mhz") == 500);
+	fake_block(dir, "gt_max_freq_mhz", false);
+
+	gpu_freq_close(&f);
+	assert(fake_read(dir, "gt_min_freq_mhz") == 900);
+	assert(fake_read(dir, "gt_max_freq_mhz") == 900);
+
+	for (unsigned i = 0; i < sizeof(fake_attrs) / sizeof(fake_attrs[0]); i++) {
+		char path[256];
+
+		snprintf(path, sizeof(path), "%s/%s", dir, fake_attrs[i]);
+		unlink(path);
+	}
+	rmdir(dir);
+	printf("gpu_freq: ok\n");
+}
+
+static uint64_t read_poll(void *data)
+{
+	return *(uint64_t *)data;
+}
+
+/*
+ * The sampler polled by hand, without its thread: a counter read from a
+ * fake sysfs attribute past INT_MAX, as rc6 residency gets after a few
+ * weeks, and a gauge that is the poll number.
+ */
+static void check_sampler(void)
+{
+	const int64_t rc6 = 3000000000ll;
+	char dir[] = "/tmp/gem_exec_blt.XXXXXX";
+	struct sampler_sample out[8];
+	struct sampler s;
+	struct sysfs_dir d;
+	uint64_t poll;
+	double values[2];
+	unsigned int count;
+	char path[256];
+
+	assert(mkdtemp(dir));
+	fake_write(dir, "rc6_residency_ms", rc6);
+	assert(sysfs_open(&d, dir) == 0);
+	assert(sampler_init(&s, 8, 1000) == 0);
+	assert(s.size == 8);
+	assert(sampler_add_sysfs(&s, &d, "rc6_residency_ms",
+				 SAMPLER_COUNTER) == 0);
+	assert(sampler_add_counter(&s, "poll", read_poll, &poll,
+				   SAMPLER_GAUGE) == 1);
+
+	for (poll = 0; poll < 20; poll++) {
+		fake_write(dir, "rc6_residency_ms", rc6 + 10 * poll);
+		sampler_poll(&s);
+		usleep(1000);
+	}
+
+	/* only the last 8 polls are left, oldest first */
+	count = sampler_snapshot(&s, out);
+	assert(count == 8);
+	for (unsigned int n = 0; n < count; n++) {
+		assert(out[n].value[0] == rc6 + 10 * (12 + n));
+		assert(out[n].value[1] == 12 + n);
+		assert(!n || out[n].time > out[n - 1].time);
+	}
+
+	/* a poll claimed but not published reuses the oldest slot */
+	s.claimed = s.head + 1;
+	assert(sampler_snapshot(&s, out) == 7);
+	assert(out[0].value[1] == 13 && out[6].value[1] == 19);
+	s.claimed = s.head;
+	assert(sampler_snapshot(&s, out) == 8);
 
-	sysfs_write("gt_min_freq_mhz", min);
-	sysfs_write("gt_max_freq_mhz", max);
+	/* polls 14 to 17 frame a window between the times of 14 and 17 */
+	count = sampler_summary(&s, out[2].time + 1, out[5].time - 1, values);
+	assert(count == 4);
+	assert(fabs(values[0] - 30. * NSEC_PER_SEC /
+		    (out[5].time - out[2].time)) < 1e-6 * values[0]);
+	assert(values[1] == 15.5);
+
+	/* a single sample has no rate */
+	count = sampler_summary(&s, out[3].time, out[3].time, values);
+	assert(count == 1);
+	assert(isnan(values[0]));
+	assert(values[1] == 15);
+
+	sampler_fini(&s);
+	sysfs_close(&d);
+	snprintf(path, sizeof(path), "%s/rc6_residency_ms", dir);
+	unlink(path);
+	rmdir(dir);
+	printf("sampler: ok\n");
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-s] [-m max-size-MiB] [-b size-KiB [-k max-blits] [-d]]\n"
+	       "          [-f [-S step-MHz]] [-R sysfs-root] [-T] [-g window-ms [-t]]\n"
+	       "          [-E [-P powercap-root]] [-c]\n"
+	       "  -s  sweep copies from 4KiB to max-size over pitches and blits\n"
+	       "      per batch, at each frequency setting\n"
+	       "  -m  largest copy in the sweep (default 1024)\n"
+	       "  -b  frames of small copies of size-KiB, batched against one\n"
+	       "      execbuf per copy, at each frequency setting\n"
+	       "  -k  largest frame, in copies (default 64)\n"
+	       "  -d  each copy reads what the previous one wrote\n"
+	       "  -f  step through every frequency from RPn to RP0 instead of\n"
+	       "      just auto, min and max\n"
+	       "  -S  MHz between frequency steps (default %d)\n"
+	       "  -R  sysfs directory of the card (default /sys/class/drm/cardN)\n"
+	       "  -T  sample frequency, rc6 and blitter busyness in the background\n"
+	       "      and report them next to each result\n"
+	       "  -g  after each frequency change, wait until the gpu frequency\n"
+	       "      has held steady for window-ms before measuring\n"
+	       "  -t  also wait for the cpu package temperature\n"
+	       "  -E  report the power and energy per GB or per blit from the\n"
+	       "      RAPL counters, and the most efficient frequency with -f\n"
+	       "  -P  powercap directory (default /sys/class/powercap)\n"
+	       "  -c  check the frequency control and the telemetry sampler against\n"
+	       "      a fake sysfs tree in a temporary directory, without a gpu\n",
+	       name, GPU_FREQ_STEP);
+}
+
+int main(int argc, char **argv)
+{
+	struct subtest t = {
+		.max_size = 1024ull << 20,
+		.max_count = 64,
+	};
+	struct gpu_freq freq;
+	struct stable_gate gate;
+	struct sysfs_dir temp;
+	const char *root = NULL, *powercap = NULL;
+	bool freq_sweep = false, sample = false, watch_temp = false;
+	bool energy = false, self_check = false;
+	int step = 0, window_ms = -1;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "sm:b:k:dfS:R:Tg:tEP:ch")) != -1) {
+		switch (c) {
+		case 's':
+			t.sweep = true;
+			break;
+		case 'm':
+			t.max_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'b':
+			t.frame_size = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'k':
+			t.max_count = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			t.dependent = true;
+			break;
+		case 'f':
+			freq_sweep = true;
+			break;
+		case 'S':
+			step = atoi(optarg);
+			break;
+		case 'R':
+			root = optarg;
+			break;
+		case 'T':
+			sample = true;
+			break;
+		case 'g':
+			window_ms = atoi(optarg);
+			break;
+		case 't':
+			watch_temp = true;
+			break;
+		case 'E':
+			energy = true;
+			break;
+		case 'P':
+			powercap = optarg;
+			break;
+		case 'c':
+			self_check = true;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!t.max_count ||
+	    (t.frame_size > FRAME_PITCH && t.frame_size % FRAME_PITCH)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (self_check) {
+		check_gpu_freq();
+		check_sampler();
+		return 0;
+	}
+
+	if (sample)
+		telemetry_init(root);
+	if (energy)
+		power_init(powercap);
+
+	err = gpu_freq_open(&freq, root, step);
+	if (err) {
+		printf("No frequency control: %s\n", strerror(-err));
+		run_subtest(&t);
+		power_fini();
+		telemetry_fini();
+		return 0;
+	}
+
+	t.fd = drm_open_driver(DRIVER_INTEL);
+	if (window_ms >= 0) {
+		stable_gate_init(&gate, &freq.sysfs, watch_temp ? &temp : NULL,
+				 window_ms);
+		if (watch_temp && !gate.temp)
+			printf("No package temperature to wait for\n");
+		t.gate = &gate;
+	}
+
+	if (freq_sweep) {
+		if (!t.frame_size && !t.sweep) {
+			printf("%8s %8s ", "MHz", "actual");
+			if (t.gate)
+				printf("%10s ", "stable(ms)");
+			printf("%10s %6s %6s %12s %12s %10s",
+			       "size(KiB)", "pitch", "blits",
+			       "latency(us)", "blit(us)", "GB/s");
+			telemetry_header();
+			power_header("J/GB");
+			printf("\n");
+		}
+		err = gpu_freq_sweep(&freq, t.fd, freq_step, &t);
+		if (err)
+			printf("Setting the frequency failed: %s\n",
+			       strerror(-err));
+		if (t.best_mhz)
+			printf("Most efficient at %dMHz: %.3f J/GB, %.3f GB/s per W\n",
+			       t.best_mhz, t.best_j_per_gb, 1 / t.best_j_per_gb);
+	} else {
+		const struct {
+			int min, max;
+		} rps[] = {
+			{ freq.rpn, freq.rp0 },
+			{ freq.rpn, freq.rpn },
+			{ freq.rp0, freq.rp0 },
+		};
+
+		for (unsigned i = 0; i < sizeof(rps) / sizeof(rps[0]); i++) {
+			if (rps[i].min == rps[i].max)
+				printf("Setting to %dMHz\n", rps[i].min);
+			else
+				printf("Setting to %d-%dMHz auto\n",
+				       rps[i].min, rps[i].max);
+			assert(gpu_freq_set(&freq, rps[i].min, rps[i].max) == 0);
+			if (t.gate) {
+				double stable = wait_stable(&t);
+
+				if (stable < 0)
+					printf("Not stable\n");
+				else
+					printf("Stable after %.1fms\n", stable);
+			}
+			run_subtest(&t);
+			printf("\n");
+		}
+	}
+
+	if (t.gate && gate.temp)
+		sysfs_close(&temp);
+	close(t.fd);
+	gpu_freq_close(&freq);
+	power_fini();
+	telemetry_fini();
+	return 0;
 }
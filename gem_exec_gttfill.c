@@ -21,20 +21,31 @@
  * IN THE SOFTWARE.
  */
 
+#include <getopt.h>
 #include "gkit_lib.h"
 #include "intel_reg.h"
 
 #define BATCH_SIZE (4096<<10)
+#define MAX_SAMPLES (1 << 20)
+#define MAX_THREADS 64
+#define MAX_CONTEXTS 64
 
 struct batch {
 	uint32_t handle;
+	uint32_t ctx;
 	void *ptr;
+	uint64_t offset;
 };
 
+/*
+ * Execute every batch once. With @latencies, the time spent in each execbuf
+ * is appended there until MAX_SAMPLES have been collected.
+ */
 static void submit(int fd,
 		   struct drm_i915_gem_execbuffer2 *eb,
 		   struct drm_i915_gem_relocation_entry *reloc,
-		   struct batch *batches, unsigned int count)
+		   struct batch *batches, unsigned int count,
+		   uint64_t *latencies, unsigned int *nlatency)
 {
 	struct drm_i915_gem_exec_object2 obj;
 	uint32_t batch[16];
@@ -76,12 +87,83 @@ static void submit(int fd,
 		memcpy(batches[i].ptr + eb->batch_start_offset,
 		       batch, sizeof(batch));
 
-		gem_execbuf(fd, eb);
+		eb->rsvd1 = batches[i].ctx;
+		if (latencies) {
+			struct timespec t = {};
+			uint64_t ns;
+
+			nsec_elapsed(&t);
+			gem_execbuf(fd, eb);
+			ns = nsec_elapsed(&t);
+			if (*nlatency < MAX_SAMPLES)
+				latencies[(*nlatency)++] = ns;
+		} else {
+			gem_execbuf(fd, eb);
+		}
 	}
 	/* As we have been lying about the write_domain, we need to do a sync */
 	gem_sync(fd, obj.handle);
 }
 
+static void create_batches(int fd, struct batch *batches, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		batches[i].handle = gem_create(fd, BATCH_SIZE);
+		batches[i].offset = -1;
+		batches[i].ptr =
+			__gem_mmap__wc(fd, batches[i].handle,
+				       0, BATCH_SIZE, PROT_WRITE);
+		if (!batches[i].ptr) {
+			printf("GTT ");
+			batches[i].ptr =
+				gem_mmap__gtt(fd, batches[i].handle,
+						BATCH_SIZE, PROT_WRITE);
+		}
+	}
+}
+
+static void destroy_batches(int fd, struct batch *batches, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		munmap(batches[i].ptr, BATCH_SIZE);
+		gem_close(fd, batches[i].handle);
+	}
+}
+
+/*
+ * Check that every batch wrote its own address where it was told to, and
+ * return how many were bound somewhere else than in the previous cycle:
+ * those were evicted in between.
+ */
+static unsigned check_batches(const struct drm_i915_gem_relocation_entry *reloc,
+			      struct batch *batches, unsigned count)
+{
+	unsigned moved = 0;
+
+	for (unsigned i = 0; i < count; i++) {
+		uint64_t offset, delta;
+		offset = *(uint64_t *)(batches[i].ptr + reloc[1].offset);
+		delta = *(uint64_t *)(batches[i].ptr + reloc[0].delta);
+		assert(offset == delta);
+
+		if (batches[i].offset != -1ull && batches[i].offset != offset)
+			moved++;
+		batches[i].offset = offset;
+	}
+
+	return moved;
+}
+
+static uint64_t aperture_size(int fd)
+{
+	uint64_t size = gem_aperture_size(fd);
+
+	if (size > 1ull<<32) /* Limit to 4GiB as we do not use allow-48b */
+		size = 1ull << 32;
+
+	return size;
+}
+
 static void fillgtt(int fd, unsigned ring, int timeout)
 {
 	struct drm_i915_gem_execbuffer2 execbuf;
@@ -94,10 +176,7 @@ static void fillgtt(int fd, unsigned ring, int timeout)
 
 	nengine = 0;
 
-	size = gem_aperture_size(fd);
-	if (size > 1ull<<32) /* Limit to 4GiB as we do not use allow-48b */
-		size = 1ull << 32;
-
+	size = aperture_size(fd);
 	count = size / BATCH_SIZE + 1;
 	printf(" %luM ", size/1024/1024);
 
@@ -105,45 +184,750 @@ static void fillgtt(int fd, unsigned ring, int timeout)
 	execbuf.buffer_count = 1;
 
 	batches = calloc(count, sizeof(*batches));
-	for (unsigned i = 0; i < count; i++) {
-		batches[i].handle = gem_create(fd, BATCH_SIZE);
-		batches[i].ptr =
-			__gem_mmap__wc(fd, batches[i].handle,
-				       0, BATCH_SIZE, PROT_WRITE);
-		if (!batches[i].ptr) {
-			printf("GTT ");
-			batches[i].ptr =
-				gem_mmap__gtt(fd, batches[i].handle,
-						BATCH_SIZE, PROT_WRITE);
-		}
-	}
+	create_batches(fd, batches, count);
 
-	uint64_t cycles = 0;
+	uint64_t cycles = 0, moved = 0;
 	execbuf.batch_start_offset = 0;
 	execbuf.flags |= ring;
 	until_timeout(timeout) {
-		submit(fd, &execbuf, reloc, batches, count);
+		submit(fd, &execbuf, reloc, batches, count, NULL, NULL);
+		moved += check_batches(reloc, batches, count);
+		cycles++;
+	}
+	printf("%llu cycles, %llu batches moved\n",
+	       (long long)cycles, (long long)moved);
+
+	destroy_batches(fd, batches, count);
+	free(batches);
+}
+
+/*
+ * A readback object for fillgtt_readback(): snooped and read through a cpu
+ * mmap where the platform allows, otherwise fetched with a single PREAD.
+ */
+struct readback {
+	uint32_t handle;
+	uint64_t *map;
+	uint64_t *copy;
+	uint64_t *expected;
+};
+
+static void readback_init(int fd, struct readback *rb, unsigned count)
+{
+	rb->handle = gem_create(fd, count * sizeof(uint64_t));
+	rb->map = NULL;
+	if (__gem_set_caching(fd, rb->handle, I915_CACHING_CACHED) == 0)
+		rb->map = __gem_mmap__cpu(fd, rb->handle, 0,
+					  count * sizeof(uint64_t),
+					  PROT_READ | PROT_WRITE);
+	rb->copy = calloc(count, sizeof(uint64_t));
+	rb->expected = calloc(count, sizeof(uint64_t));
+	assert(rb->copy && rb->expected);
+}
+
+static void readback_fini(int fd, struct readback *rb, unsigned count)
+{
+	if (rb->map)
+		munmap(rb->map, count * sizeof(uint64_t));
+	gem_close(fd, rb->handle);
+	free(rb->copy);
+	free(rb->expected);
+}
+
+/* Wait for the cycle that wrote @rb, check it and clear it for reuse */
+static void readback_check(int fd, struct readback *rb, unsigned count)
+{
+	const uint64_t *v;
+
+	if (rb->map) {
+		gem_set_domain(fd, rb->handle,
+			       I915_GEM_DOMAIN_CPU, I915_GEM_DOMAIN_CPU);
+		v = rb->map;
+	} else {
+		gem_read(fd, rb->handle, 0, rb->copy, count * sizeof(uint64_t));
+		v = rb->copy;
+	}
+
+	for (unsigned i = 0; i < count; i++)
+		assert(v[i] == rb->expected[i]);
+
+	if (rb->map) {
+		memset(rb->map, 0, count * sizeof(uint64_t));
+	} else {
+		memset(rb->copy, 0, count * sizeof(uint64_t));
+		gem_write(fd, rb->handle, 0, rb->copy, count * sizeof(uint64_t));
+	}
+}
+
+/*
+ * fillgtt(), but every batch stores its own address into its slot of a
+ * shared readback object instead of into itself, and the batches are only
+ * written once. The readback objects alternate between cycles, so one
+ * cycle is checked while the next is already queued, and the offsets the
+ * kernel reports back from execbuf are what they are checked against.
+ */
+static void fillgtt_readback(int fd, unsigned ring, int timeout)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj[2];
+	struct drm_i915_gem_relocation_entry reloc[2];
+	struct readback rb[2];
+	struct batch *batches;
+	uint64_t size, cycles = 0;
+	unsigned count;
+
+	size = aperture_size(fd);
+	count = size / BATCH_SIZE + 1;
+
+	batches = calloc(count, sizeof(*batches));
+	assert(batches);
+	create_batches(fd, batches, count);
+	for (int i = 0; i < 2; i++)
+		readback_init(fd, &rb[i], count);
+	printf(" %luM, readback by %s ", size/1024/1024,
+	       rb[0].map ? "cpu mmap" : "pread");
+
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t batch[6];
+		unsigned n = 0;
+
+		batch[n] = MI_STORE_DWORD_IMM;
+			batch[n] |= 1 << 21;
+			batch[n]++;
+			batch[++n] = i * sizeof(uint64_t);/* lower_32_bits(address) */
+			batch[++n] = 0; /* upper_32_bits(address) */
+		batch[++n] = 0; /* lower_32_bits(value) */
+		batch[++n] = 0; /* upper_32_bits(value) */
+		batch[++n] = MI_BATCH_BUFFER_END;
+		memcpy(batches[i].ptr, batch, sizeof(batch));
+	}
+
+	memset(reloc, 0, sizeof(reloc));
+	reloc[0].offset = sizeof(uint32_t);
+	reloc[0].read_domains = I915_GEM_DOMAIN_RENDER;
+	reloc[0].write_domain = I915_GEM_DOMAIN_RENDER;
+	reloc[1].offset = 3*sizeof(uint32_t);
+	reloc[1].read_domains = I915_GEM_DOMAIN_INSTRUCTION;
+
+	memset(obj, 0, sizeof(obj));
+	obj[1].relocs_ptr = (uint64_t)reloc;
+	obj[1].relocation_count = 2;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)obj;
+	execbuf.buffer_count = 2;
+	execbuf.flags = ring;
+
+	until_timeout(timeout) {
+		struct readback *cur = &rb[cycles & 1];
+
+		obj[0].handle = cur->handle;
+		reloc[0].target_handle = cur->handle;
 		for (unsigned i = 0; i < count; i++) {
-			uint64_t offset, delta;
-			offset = *(uint64_t *)(batches[i].ptr + reloc[1].offset);
-			delta = *(uint64_t *)(batches[i].ptr + reloc[0].delta);
-			assert(offset == delta);
+			obj[0].offset = 0;
+			obj[1].handle = batches[i].handle;
+			obj[1].offset = 0;
+			reloc[0].delta = i * sizeof(uint64_t);
+			reloc[0].presumed_offset = 0;
+			reloc[1].target_handle = batches[i].handle;
+			reloc[1].presumed_offset = 0;
+
+			gem_execbuf(fd, &execbuf);
+			cur->expected[i] = obj[1].offset;
 		}
+
+		if (cycles)
+			readback_check(fd, &rb[(cycles - 1) & 1], count);
 		cycles++;
 	}
+	readback_check(fd, &rb[(cycles - 1) & 1], count);
 	printf("%llu cycles\n", (long long)cycles);
 
-	for (unsigned i = 0; i < count; i++) {
-		munmap(batches[i].ptr, BATCH_SIZE);
-		gem_close(fd, batches[i].handle);
+	for (int i = 0; i < 2; i++)
+		readback_fini(fd, &rb[i], count);
+	destroy_batches(fd, batches, count);
+	free(batches);
+}
+
+struct filler {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	int fd;
+	unsigned ring;
+	int timeout;
+
+	struct batch *batches;
+	unsigned count;
+	uint32_t ctx[MAX_CONTEXTS];
+	unsigned nctx;
+	bool shared_vm;
+
+	uint64_t cycles;
+	uint64_t moved;
+	uint64_t *latencies;
+	unsigned nlatency;
+};
+
+/*
+ * One of fillgtt_threads() workers: it owns its share of the batches, maps
+ * and fills them itself, and spreads them over its own contexts. Those all
+ * live in the address space of the default context, or without shared vm
+ * support the worker submits on the default context itself.
+ */
+static void *filler_thread(void *data)
+{
+	struct filler *f = data;
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_relocation_entry reloc[2];
+
+	for (unsigned c = 0; c < f->nctx && f->shared_vm; c++) {
+		f->ctx[c] = gem_context_create(f->fd);
+		assert(__gem_context_share_vm(f->fd, f->ctx[c], 0) == 0);
+	}
+	create_batches(f->fd, f->batches, f->count);
+	for (unsigned i = 0; i < f->count; i++)
+		f->batches[i].ctx = f->ctx[i % f->nctx];
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffer_count = 1;
+	execbuf.flags = f->ring;
+
+	pthread_barrier_wait(f->barrier);
+	until_timeout(f->timeout) {
+		submit(f->fd, &execbuf, reloc, f->batches, f->count,
+		       f->latencies, &f->nlatency);
+		/* contexts are not ordered, wait for the last batch of each */
+		for (unsigned i = f->count > f->nctx ? f->count - f->nctx : 0;
+		     i < f->count; i++)
+			gem_sync(f->fd, f->batches[i].handle);
+		f->moved += check_batches(reloc, f->batches, f->count);
+		f->cycles++;
 	}
+	pthread_barrier_wait(f->barrier);
+
+	destroy_batches(f->fd, f->batches, f->count);
+	for (unsigned c = 0; c < f->nctx && f->shared_vm; c++)
+		gem_context_destroy(f->fd, f->ctx[c]);
+
+	return NULL;
 }
 
-int main()
+/*
+ * fillgtt() with the batches split between @nthreads workers, each with
+ * @nctx contexts of its own. Every context shares one address space, which
+ * the batches overfill together as in fillgtt(), so the workers all evict
+ * each other's batches at once.
+ */
+static void fillgtt_threads(int fd, unsigned ring, int timeout,
+			    unsigned nthreads, unsigned nctx)
+{
+	struct filler fillers[MAX_THREADS];
+	pthread_barrier_t barrier;
+	struct timespec start = {};
+	struct batch *batches;
+	uint64_t size, elapsed, execbufs = 0, moved = 0;
+	unsigned count;
+	bool shared_vm;
+	uint32_t probe;
+
+	size = aperture_size(fd);
+	count = size / BATCH_SIZE + 1;
+	if (nthreads > count)
+		nthreads = count;
+
+	/* contexts with their own vm would each have room for every batch */
+	probe = gem_context_create(fd);
+	shared_vm = __gem_context_share_vm(fd, probe, 0) == 0;
+	gem_context_destroy(fd, probe);
+	if (!shared_vm) {
+		printf(" no shared vm, every thread on the default context\n");
+		nctx = 1;
+	}
+
+	printf(" %luM, %u threads, %u contexts each\n",
+	       (unsigned long)(size >> 20), nthreads, nctx);
+
+	batches = calloc(count, sizeof(*batches));
+	assert(batches);
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (unsigned t = 0; t < nthreads; t++) {
+		struct filler *f = &fillers[t];
+		unsigned first = t * count / nthreads;
+
+		memset(f, 0, sizeof(*f));
+		f->barrier = &barrier;
+		f->fd = fd;
+		f->ring = ring;
+		f->timeout = timeout;
+		f->batches = batches + first;
+		f->count = (t + 1) * count / nthreads - first;
+		f->nctx = nctx;
+		f->shared_vm = shared_vm;
+		f->latencies = calloc(MAX_SAMPLES, sizeof(*f->latencies));
+		assert(f->latencies);
+
+		assert(pthread_create(&f->thread, NULL, filler_thread, f) == 0);
+	}
+
+	pthread_barrier_wait(&barrier);
+	nsec_elapsed(&start);
+	pthread_barrier_wait(&barrier);
+	elapsed = nsec_elapsed(&start);
+
+	printf("%6s %8s %8s %8s %10s %10s %10s\n", "thread", "batches",
+	       "cycles", "moved", "p50(us)", "p99(us)", "max(us)");
+	for (unsigned t = 0; t < nthreads; t++) {
+		struct filler *f = &fillers[t];
+
+		pthread_join(f->thread, NULL);
+		execbufs += f->cycles * f->count;
+		moved += f->moved;
+
+		sort_u64(f->latencies, f->nlatency);
+		printf("%6u %8u %8llu %8llu %10.1f %10.1f %10.1f\n",
+		       t, f->count, (unsigned long long)f->cycles,
+		       (unsigned long long)f->moved,
+		       percentile_u64(f->latencies, f->nlatency, 50) / 1000.0,
+		       percentile_u64(f->latencies, f->nlatency, 99) / 1000.0,
+		       f->nlatency ? f->latencies[f->nlatency - 1] / 1000.0 : 0);
+		free(f->latencies);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	printf("aggregate: %.2f fills/s, %.0f execbuf/s\n",
+	       (double)execbufs / count * 1e9 / elapsed,
+	       (double)execbufs * 1e9 / elapsed);
+	if (!moved)
+		printf("warning: no batch was ever moved, nothing was evicted\n");
+
+	free(batches);
+}
+
+enum locality { LRU, RANDOM, CYCLIC, NUM_LOCALITIES };
+static const char *locality_names[] = { "lru", "random", "cyclic" };
+
+/* Working set sizes visited by thrash(), in percent of the aperture */
+static const unsigned thrash_steps[] = {
+	10, 25, 50, 75, 90, 100, 110, 125, 150, 200, 250, 300
+};
+
+/*
+ * The @n'th object to execute out of a working set of @count, of which @fit
+ * fit into the aperture at once. LRU walks a window of half the aperture
+ * four times before sliding on, so eviction only ever picks objects that
+ * are done with; cyclic walks the whole set in order, the worst case for
+ * LRU eviction once it no longer fits; random picks uniformly.
+ */
+static unsigned next_object(enum locality locality, uint64_t n,
+			    unsigned count, unsigned fit)
+{
+	unsigned window;
+
+	switch (locality) {
+	case LRU:
+		window = fit / 2 < count ? fit / 2 : count;
+		if (!window)
+			window = 1;
+		return (n / (4 * window) * window + n % window) % count;
+	case RANDOM:
+		return random() % count;
+	case CYCLIC:
+	default:
+		return n % count;
+	}
+}
+
+static void execute(int fd, unsigned ring, uint32_t handle)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.handle = handle;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&obj;
+	execbuf.buffer_count = 1;
+	execbuf.batch_len = 8;
+	execbuf.flags = ring;
+	gem_execbuf(fd, &execbuf);
+}
+
+/*
+ * Sweep the working set from 10% to @max_pct of the aperture, executing one
+ * BATCH_SIZE object after another in the given locality for @timeout seconds
+ * at each step, and report how long each execbuf took (binding, and once
+ * the set no longer fits, evicting) and how many we got through.
+ */
+static void thrash(int fd, unsigned ring, enum locality locality,
+		   unsigned max_pct, int timeout)
+{
+	const uint32_t bbe[2] = { MI_BATCH_BUFFER_END };
+	uint64_t size, *latencies;
+	unsigned fit, max_count, created = 0;
+	uint32_t *handles;
+
+	size = aperture_size(fd);
+	fit = size / BATCH_SIZE;
+	max_count = (uint64_t)fit * max_pct / 100;
+
+	handles = calloc(max_count, sizeof(*handles));
+	latencies = calloc(MAX_SAMPLES, sizeof(*latencies));
+	assert(handles && latencies);
+
+	printf("aperture %luM, locality %s\n",
+	       (unsigned long)(size >> 20), locality_names[locality]);
+	printf("%5s %8s %8s %10s %10s %10s %10s %10s\n",
+	       "set", "size(M)", "objects", "execbuf/s",
+	       "avg(us)", "p50(us)", "p99(us)", "max(us)");
+
+	for (unsigned s = 0; s < sizeof(thrash_steps) / sizeof(thrash_steps[0]); s++) {
+		unsigned count = (uint64_t)fit * thrash_steps[s] / 100;
+		struct timespec start = {};
+		uint64_t n = 0, total = 0, elapsed;
+		unsigned samples;
+
+		if (thrash_steps[s] > max_pct)
+			break;
+		if (!count)
+			count = 1;
+
+		/* populate the new objects outside of the measurement */
+		for (; created < count; created++) {
+			handles[created] = gem_create(fd, BATCH_SIZE);
+			gem_write(fd, handles[created], 0, bbe, sizeof(bbe));
+			execute(fd, ring, handles[created]);
+		}
+		gem_sync(fd, handles[created - 1]);
+
+		nsec_elapsed(&start);
+		until_timeout(timeout) {
+			struct timespec t = {};
+			uint64_t ns;
+
+			nsec_elapsed(&t);
+			execute(fd, ring,
+				handles[next_object(locality, n, count, fit)]);
+			ns = nsec_elapsed(&t);
+
+			if (n < MAX_SAMPLES)
+				latencies[n] = ns;
+			total += ns;
+			n++;
+		}
+		for (unsigned i = 0; i < count; i++)
+			gem_sync(fd, handles[i]);
+		elapsed = nsec_elapsed(&start);
+
+		samples = n < MAX_SAMPLES ? n : MAX_SAMPLES;
+		sort_u64(latencies, samples);
+		printf("%4u%% %8lu %8u %10.0f %10.1f %10.1f %10.1f %10.1f\n",
+		       thrash_steps[s], (unsigned long)count * (BATCH_SIZE >> 20),
+		       count, n * 1e9 / elapsed, (double)total / n / 1000.0,
+		       percentile_u64(latencies, samples, 50) / 1000.0,
+		       percentile_u64(latencies, samples, 99) / 1000.0,
+		       samples ? latencies[samples - 1] / 1000.0 : 0);
+		fflush(stdout);
+	}
+
+	for (unsigned i = 0; i < created; i++)
+		gem_close(fd, handles[i]);
+	free(latencies);
+	free(handles);
+}
+
+/*
+ * The same number of batches as fillgtt() executes, but packed @slots to a
+ * BATCH_SIZE object at evenly spaced batch_start_offsets. submit() has the
+ * batch at slot k store into the last 8 bytes of slot (slots - 1 - k), so
+ * slots must leave room after the 64 bytes of commands copied into each.
+ */
+static void suballoc(int fd, unsigned ring, int timeout, unsigned slots)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_relocation_entry reloc[2];
+	struct timespec start = {};
+	struct batch *batches;
+	uint64_t *latencies, cycles = 0, elapsed;
+	unsigned count, nbo, stride, nlatency = 0;
+
+	count = aperture_size(fd) / BATCH_SIZE + 1;
+	nbo = (count + slots - 1) / slots;
+	stride = BATCH_SIZE / slots;
+
+	batches = calloc(nbo, sizeof(*batches));
+	latencies = calloc(MAX_SAMPLES, sizeof(*latencies));
+	assert(batches && latencies);
+	create_batches(fd, batches, nbo);
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffer_count = 1;
+	execbuf.flags = ring;
+
+	nsec_elapsed(&start);
+	until_timeout(timeout) {
+		for (unsigned k = 0; k < slots; k++) {
+			execbuf.batch_start_offset = k * stride;
+			submit(fd, &execbuf, reloc, batches, nbo,
+			       latencies, &nlatency);
+			check_batches(reloc, batches, nbo);
+		}
+		cycles++;
+	}
+	elapsed = nsec_elapsed(&start);
+
+	sort_u64(latencies, nlatency);
+	printf("%6u %6u %8u %10.0f %10.1f %10.1f %10.1f\n",
+	       slots, nbo, nbo * (BATCH_SIZE >> 20),
+	       (double)cycles * nbo * slots * 1e9 / elapsed,
+	       percentile_u64(latencies, nlatency, 50) / 1000.0,
+	       percentile_u64(latencies, nlatency, 99) / 1000.0,
+	       nlatency ? latencies[nlatency - 1] / 1000.0 : 0);
+	fflush(stdout);
+
+	destroy_batches(fd, batches, nbo);
+	free(latencies);
+	free(batches);
+}
+
+/* Sign extend bit 47, as the kernel requires of softpinned offsets */
+static uint64_t canonical_address(uint64_t offset)
+{
+	return (int64_t)(offset << 16) >> 16;
+}
+
+static uint64_t execute_pinned(int fd, unsigned ring,
+			       struct drm_i915_gem_exec_object2 *obj,
+			       unsigned count)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct timespec t = {};
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)obj;
+	execbuf.buffer_count = count;
+	execbuf.batch_len = 8;
+	execbuf.flags = ring;
+
+	nsec_elapsed(&t);
+	gem_execbuf(fd, &execbuf);
+	return nsec_elapsed(&t);
+}
+
+/*
+ * Spread small objects @stride apart across an ever larger part of the full
+ * ppgtt, softpinned with EXEC_OBJECT_SUPPORTS_48B_ADDRESS, so that tens of
+ * GiB of address space (and the page tables behind it) are in use for a
+ * few MiB of memory. At each size we report the cost of creating the new
+ * objects, of their first bind, of executing each one once bound, of moving
+ * every one to a new offset, and of a single execbuf holding them all.
+ */
+static void fill48b(int fd, unsigned ring, uint64_t max_size, uint64_t stride)
+{
+	const uint32_t bbe[2] = { MI_BATCH_BUFFER_END };
+	struct drm_i915_gem_exec_object2 *obj;
+	uint64_t vm_size, shift = 0;
+	unsigned max_count, created = 0;
+
+	vm_size = gem_aperture_size(fd);
+	if (vm_size <= 1ull << 32) {
+		printf(" no 48b address space (%luM)\n",
+		       (unsigned long)(vm_size >> 20));
+		return;
+	}
+	if (max_size > vm_size)
+		max_size = vm_size;
+	max_count = max_size / stride - 1;
+	printf(" %luG of %luG, an object every %luK\n",
+	       (unsigned long)(max_size >> 30), (unsigned long)(vm_size >> 30),
+	       (unsigned long)(stride >> 10));
+
+	obj = calloc(max_count, sizeof(*obj));
+	assert(obj);
+
+	printf("%8s %8s %10s %10s %10s %10s %10s\n", "space(G)", "objects",
+	       "setup(ms)", "bind(us)", "exec(us)", "move(us)", "bulk(ms)");
+	for (uint64_t size = 4ull << 30; size <= max_size; size <<= 1) {
+		unsigned count = size / stride - 1;
+		uint64_t setup, bind = 0, exec = 0, move = 0, bulk;
+		struct timespec start = {};
+
+		nsec_elapsed(&start);
+		for (unsigned i = created; i < count; i++) {
+			obj[i].handle = gem_create(fd, 4096);
+			gem_write(fd, obj[i].handle, 0, bbe, sizeof(bbe));
+			obj[i].flags = EXEC_OBJECT_PINNED |
+				       EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+			obj[i].offset = canonical_address((i + 1) * stride + shift);
+		}
+		setup = nsec_elapsed(&start);
+
+		for (unsigned i = created; i < count; i++)
+			bind += execute_pinned(fd, ring, &obj[i], 1);
+		gem_sync(fd, obj[count - 1].handle);
+
+		for (unsigned i = 0; i < count; i++)
+			exec += execute_pinned(fd, ring, &obj[i], 1);
+		gem_sync(fd, obj[count - 1].handle);
+
+		/* slide everything along by half a stride, into fresh ptes */
+		shift = shift ? 0 : stride / 2;
+		for (unsigned i = 0; i < count; i++) {
+			obj[i].offset = canonical_address((i + 1) * stride + shift);
+			move += execute_pinned(fd, ring, &obj[i], 1);
+		}
+		gem_sync(fd, obj[count - 1].handle);
+
+		bulk = execute_pinned(fd, ring, obj, count);
+		gem_sync(fd, obj[count - 1].handle);
+
+		printf("%8lu %8u %10.1f %10.2f %10.2f %10.2f %10.2f\n",
+		       (unsigned long)(size >> 30), count, setup / 1e6,
+		       created < count ? bind / 1000.0 / (count - created) : 0,
+		       exec / 1000.0 / count, move / 1000.0 / count,
+		       bulk / 1e6);
+		fflush(stdout);
+
+		created = count;
+	}
+
+	for (unsigned i = 0; i < created; i++)
+		gem_close(fd, obj[i].handle);
+	free(obj);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-b] [-t threads] [-c contexts] [-s max-slots] [-w]\n"
+	       "          [-l lru|random|cyclic|all] [-p max-percent] [-d seconds]\n"
+	       "          [-a max-GiB] [-k stride-KiB]\n"
+	       "  -b  have the batches report into a shared readback object, checked\n"
+	       "      while the next cycle runs, instead of reading each batch back\n"
+	       "      through its WC map\n"
+	       "  -t  split the batches between threads that fill the aperture\n"
+	       "      concurrently, and report each one's submit latency\n"
+	       "  -c  contexts per thread (default 1), all sharing one address space\n"
+	       "  -s  pack 1, 4, 16... up to max-slots batches into each object at\n"
+	       "      different batch_start_offsets, and compare execbuf cost and\n"
+	       "      footprint against one object per batch\n"
+	       "  -w  sweep the working set from 10%% of the aperture upwards and\n"
+	       "      report execbuf latency and throughput at each step\n"
+	       "  -l  order in which the working set is executed (default all)\n"
+	       "  -p  largest working set, in percent of the aperture (default 300)\n"
+	       "  -d  seconds spent filling with -b or threads, at each packing or\n"
+	       "      at each step (default 1)\n"
+	       "  -a  softpin objects across 4GiB, 8GiB... up to max-GiB of the\n"
+	       "      48b address space and report setup and execbuf costs\n"
+	       "  -k  distance between the softpinned objects, a multiple of 8\n"
+	       "      (default 2048)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
 {
 	const struct intel_execution_engine *e;
 	int device = -1;
+	bool sweep = false, bulk = false;
+	int locality = -1;
+	unsigned max_pct = 300;
+	unsigned nthreads = 0, nctx = 1, max_slots = 0;
+	uint64_t max_space = 0, stride = 2 << 20;
+	int timeout = 1;
+	int c;
+
+	while ((c = getopt(argc, argv, "bt:c:s:wl:p:d:a:k:h")) != -1) {
+		switch (c) {
+		case 'a':
+			max_space = strtoull(optarg, NULL, 0) << 30;
+			break;
+		case 'k':
+			stride = strtoull(optarg, NULL, 0) << 10;
+			break;
+		case 'b':
+			bulk = true;
+			break;
+		case 's':
+			max_slots = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'c':
+			nctx = atoi(optarg);
+			break;
+		case 'w':
+			sweep = true;
+			break;
+		case 'l':
+			locality = -1;
+			for (int l = 0; l < NUM_LOCALITIES; l++)
+				if (strcmp(optarg, locality_names[l]) == 0)
+					locality = l;
+			if (locality < 0 && strcmp(optarg, "all")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'p':
+			max_pct = atoi(optarg);
+			break;
+		case 'd':
+			timeout = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (max_pct < thrash_steps[0] || nthreads > MAX_THREADS ||
+	    !nctx || nctx > MAX_CONTEXTS || max_slots > BATCH_SIZE / 128 ||
+	    stride < 8192 || stride & 8191) {
+		usage(argv[0]);
+		return 1;
+	}
+
 	device = drm_open_driver(DRIVER_INTEL);
+	if (sweep) {
+		for (int l = 0; l < NUM_LOCALITIES; l++)
+			if (locality < 0 || locality == l)
+				thrash(device, I915_EXEC_RENDER, l, max_pct, timeout);
+		close(device);
+		return 0;
+	}
+
+	if (max_slots) {
+		printf("RENDER ENGINE:\n");
+		printf("%6s %6s %8s %10s %10s %10s %10s\n", "slots", "objects",
+		       "size(M)", "execbuf/s", "p50(us)", "p99(us)", "max(us)");
+		for (unsigned slots = 1; slots <= max_slots; slots <<= 2)
+			suballoc(device, I915_EXEC_RENDER, timeout, slots);
+		close(device);
+		return 0;
+	}
+
+	if (max_space) {
+		printf("RENDER ENGINE:");
+		fill48b(device, I915_EXEC_RENDER, max_space, stride);
+		close(device);
+		return 0;
+	}
+
+	if (bulk) {
+		printf("RENDER ENGINE:\t");
+		fillgtt_readback(device, I915_EXEC_RENDER, timeout);
+		close(device);
+		return 0;
+	}
+
+	if (nthreads) {
+		printf("RENDER ENGINE:");
+		fillgtt_threads(device, I915_EXEC_RENDER, timeout, nthreads, nctx);
+		close(device);
+		return 0;
+	}
+
 	printf("RENDER ENGINE:\t");
 	fillgtt(device, I915_EXEC_RENDER, 1); /* just enough to run a single pass */
 	return 0;
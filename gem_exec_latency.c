@@ -23,10 +23,14 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
 #include "gkit_lib.h"
 
 #define _TIMES 128
 
+#define HOG_SIZE_DEFAULT (16 << 20)
+
 static uint32_t create_highest_priority(int fd)
 {
 	uint32_t ctx = gem_context_create(fd);
@@ -36,6 +40,15 @@ static uint32_t create_highest_priority(int fd)
 	return ctx;
 }
 
+static uint32_t create_lowest_priority(int fd)
+{
+	uint32_t ctx = gem_context_create(fd);
+
+	__gem_context_set_priority(fd, ctx, LOCAL_I915_CONTEXT_MIN_USER_PRIORITY);
+
+	return ctx;
+}
+
 static uint64_t latencies[_TIMES];
 static uint64_t total_latency;
 
@@ -84,18 +97,228 @@ static uint64_t calc_average_latency(int fd)
 	return total_latency/_TIMES;	
 }
 
+/*
+ * The hog keeps two long batches from a low priority context queued on the
+ * engine at all times, so every high priority submission lands behind one.
+ */
+struct hog {
+	int fd;
+	unsigned ring;
+	uint32_t ctx_id;
+	uint32_t handle[2];
+	volatile bool done;
+	pthread_t thread;
+};
+
+static void hog_submit(struct hog *hog, uint32_t handle)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 exec;
+
+	memset(&exec, 0, sizeof(exec));
+	exec.handle = handle;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&exec;
+	execbuf.buffer_count = 1;
+	execbuf.flags = hog->ring;
+	execbuf.rsvd1 = hog->ctx_id;
+
+	gem_execbuf(hog->fd, &execbuf);
+}
+
+static void *hog_thread(void *data)
+{
+	struct hog *hog = data;
+	unsigned n = 0;
+
+	hog_submit(hog, hog->handle[0]);
+	hog_submit(hog, hog->handle[1]);
+	while (!hog->done) {
+		gem_sync(hog->fd, hog->handle[n]);
+		hog_submit(hog, hog->handle[n]);
+		n ^= 1;
+	}
+
+	return NULL;
+}
+
+static void hog_start(struct hog *hog, int fd, unsigned ring,
+		      uint64_t size, unsigned arb_interval)
+{
+	memset(hog, 0, sizeof(*hog));
+	hog->fd = fd;
+	hog->ring = ring;
+	hog->ctx_id = create_lowest_priority(fd);
+	hog->handle[0] = gem_nop_batch_create(fd, size, arb_interval);
+	hog->handle[1] = gem_nop_batch_create(fd, size, arb_interval);
+
+	assert(pthread_create(&hog->thread, NULL, hog_thread, hog) == 0);
+}
+
+static void hog_stop(struct hog *hog)
+{
+	hog->done = true;
+	pthread_join(hog->thread, NULL);
+
+	for (int n = 0; n < 2; n++) {
+		gem_sync(hog->fd, hog->handle[n]);
+		gem_close(hog->fd, hog->handle[n]);
+	}
+	gem_context_destroy(hog->fd, hog->ctx_id);
+}
+
+/* Time a single hog batch on an otherwise idle engine, for reference */
+static uint64_t hog_duration(int fd, unsigned ring,
+			     uint64_t size, unsigned arb_interval)
+{
+	struct hog hog = { .fd = fd, .ring = ring };
+	struct timespec start;
+	uint64_t elapsed;
+
+	hog.handle[0] = gem_nop_batch_create(fd, size, arb_interval);
+	hog_submit(&hog, hog.handle[0]);
+	gem_sync(fd, hog.handle[0]);
+
+	clock_gettime(CLOCK_REALTIME, &start);
+	hog_submit(&hog, hog.handle[0]);
+	gem_sync(fd, hog.handle[0]);
+	elapsed = nsec_elapsed(&start);
+
+	gem_close(fd, hog.handle[0]);
+	return elapsed;
+}
+
+static void preempt_latency(int fd, unsigned ring, uint64_t hog_size)
+{
+	const struct {
+		const char *name;
+		unsigned arb_interval;
+	} modes[] = {
+		{ "arb-dense", 16 },
+		{ "arb-sparse", 16384 },
+		{ "no-arb", 0 },
+		{ NULL, 0 },
+	}, *m;
+
+	printf("%-12s %10s %10s %10s %10s %10s\n",
+	       "hog", "batch(us)", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+	for (m = modes; m->name; m++) {
+		uint64_t batch = hog_duration(fd, ring, hog_size, m->arb_interval);
+		uint64_t avg;
+		struct hog hog;
+
+		hog_start(&hog, fd, ring, hog_size, m->arb_interval);
+		avg = calc_average_latency(fd);
+		hog_stop(&hog);
+
+		sort_u64(latencies, _TIMES);
+		printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       m->name, batch / 1000.0, avg / 1000.0,
+		       percentile_u64(latencies, _TIMES, 50) / 1000.0,
+		       percentile_u64(latencies, _TIMES, 99) / 1000.0,
+		       latencies[_TIMES - 1] / 1000.0);
+		fflush(stdout);
+	}
+}
+
+/* Stand-in for sleep(1) between rounds: wait until the gpu is warm and steady */
+static void wait_stable(const struct stable_gate *gate, int fd)
+{
+	uint64_t waited;
+	int err;
+
+	err = stable_wait(gate, fd, &waited);
+	if (err)
+		printf("not stable after %.1fms: %s\n",
+		       waited / 1e6, strerror(-err));
+	else
+		printf("stable after %.1fms\n", waited / 1e6);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-p] [-s hog-size-KiB] [-g window-ms [-t]]\n"
+	       "  -p  measure max priority latency while a min priority\n"
+	       "      context hogs the engine with dense, sparse and no\n"
+	       "      MI_ARB_CHECK batches\n"
+	       "  -s  size of each hog batch in KiB (default %d)\n"
+	       "  -g  before each round, wait until the gpu frequency has held\n"
+	       "      steady for window-ms, instead of sleeping for a second\n"
+	       "  -t  also wait for the cpu package temperature\n",
+	       name, HOG_SIZE_DEFAULT >> 10);
+}
+
 int main(int argc, char **argv)
 {
 	const struct intel_execution_engine *e;
-	int fd = drm_open_driver(DRIVER_INTEL);
+	uint64_t hog_size = HOG_SIZE_DEFAULT;
+	struct sysfs_dir card, temp;
+	struct stable_gate gate;
+	int window_ms = -1;
+	bool preempt = false, watch_temp = false;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "ps:g:th")) != -1) {
+		switch (c) {
+		case 'p':
+			preempt = true;
+			break;
+		case 's':
+			hog_size = strtoull(optarg, NULL, 0) << 10;
+			break;
+		case 'g':
+			window_ms = atoi(optarg);
+			break;
+		case 't':
+			watch_temp = true;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!hog_size) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (window_ms >= 0) {
+		if (sysfs_open(&card, NULL) ||
+		    stable_gate_init(&gate, &card, watch_temp ? &temp : NULL,
+				     window_ms)) {
+			printf("No gpu frequency to wait for\n");
+			window_ms = -1;
+		} else if (watch_temp && !gate.temp) {
+			printf("No package temperature to wait for\n");
+		}
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
 	/* make GPU warm up */
 	calc_average_latency(fd);
+	if (window_ms >= 0)
+		wait_stable(&gate, fd);
+
+	if (preempt) {
+		preempt_latency(fd, I915_EXEC_RENDER, hog_size);
+		close(fd);
+		return 0;
+	}
 
 	/* measure latency formally */
 	for (int i = 0; i < 16; i++) {
 		printf("latency: %4.1fms\n", calc_average_latency(fd)/1000.0);
-		sleep(1);
+		if (window_ms >= 0)
+			wait_stable(&gate, fd);
+		else
+			sleep(1);
 	}
 	close(fd);
+	if (window_ms >= 0) {
+		sysfs_close(&card);
+		if (gate.temp)
+			sysfs_close(&temp);
+	}
 	return 0;
 }
@@ -0,0 +1,341 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Page size effects on large surfaces. The same surface is backed by a gem
+ * object (whatever pages shmemfs hands the driver), or wrapped in a userptr
+ * around 4KiB pages, transparent huge pages or hugetlbfs. For each we report
+ * how much of the cpu mapping is really backed by huge pages, as read back
+ * from /proc/self/smaps, the cost of a cpu access that touches a new page
+ * every time (dominated by TLB misses), and blitter throughput out of it.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define LOOPS 8
+#define HPAGE_SIZE (2 << 20)
+#define PAGE_SIZE 4096
+
+enum backing { BO, USERPTR_4K, USERPTR_THP, USERPTR_HUGETLB, NUM_BACKINGS };
+static const char *backing_names[] = {
+	"bo", "userptr-4k", "userptr-thp", "userptr-hugetlb"
+};
+
+struct surface {
+	enum backing backing;
+	size_t size;
+	uint32_t handle;
+	char *ptr;
+};
+
+static double blit_bw(int fd, uint32_t src, uint32_t dst, size_t size)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj[3];
+	struct drm_i915_gem_relocation_entry reloc[2];
+	struct timespec start = {};
+	uint32_t batch[16];
+	uint64_t elapsed;
+
+	memset(obj, 0, sizeof(obj));
+	obj[0].handle = src;
+	obj[1].handle = dst;
+	obj[2].handle = gem_create(fd, 4096);
+	obj[2].relocs_ptr = (uint64_t)reloc;
+	obj[2].relocation_count = 2;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)obj;
+	execbuf.buffer_count = 3;
+	execbuf.batch_len = blt_linear_copy(batch, reloc, src, dst, size);
+	execbuf.flags = I915_EXEC_BLT;
+	gem_write(fd, obj[2].handle, 0, batch, execbuf.batch_len);
+
+	/* the first pass binds the objects and populates the pages */
+	gem_execbuf(fd, &execbuf);
+	gem_sync(fd, dst);
+
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++)
+		gem_execbuf(fd, &execbuf);
+	gem_sync(fd, dst);
+	elapsed = nsec_elapsed(&start);
+
+	gem_close(fd, obj[2].handle);
+
+	return (double)LOOPS * size / elapsed;
+}
+
+/*
+ * Sum up the smaps entries of every vma overlapping [ptr, ptr + size): how
+ * much of it is resident, how much of that through PMD mappings or hugetlbfs
+ * (which smaps keeps out of Rss), and the largest page size the kernel
+ * reports for the vmas.
+ */
+static bool page_sizes(const void *ptr, size_t size, unsigned long *rss_kb,
+		       unsigned long *huge_kb, unsigned long *page_kb)
+{
+	unsigned long start = (unsigned long)ptr, end = start + size;
+	bool inside = false, found = false;
+	char line[256];
+	FILE *file;
+
+	*rss_kb = *huge_kb = *page_kb = 0;
+
+	file = fopen("/proc/self/smaps", "r");
+	if (!file)
+		return false;
+
+	while (fgets(line, sizeof(line), file)) {
+		unsigned long lo, hi, kb;
+
+		if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+			inside = lo < end && hi > start;
+			found |= inside;
+			continue;
+		}
+		if (!inside)
+			continue;
+
+		if (sscanf(line, "Rss: %lu kB", &kb) == 1)
+			*rss_kb += kb;
+		else if (sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+			 sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1)
+			*rss_kb += kb, *huge_kb += kb;
+		else if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+			 sscanf(line, "ShmemPmdMapped: %lu kB", &kb) == 1 ||
+			 sscanf(line, "FilePmdMapped: %lu kB", &kb) == 1)
+			*huge_kb += kb;
+		else if (sscanf(line, "KernelPageSize: %lu kB", &kb) == 1 &&
+			 kb > *page_kb)
+			*page_kb = kb;
+	}
+	fclose(file);
+
+	return found;
+}
+
+static bool surface_init(int fd, struct surface *s, enum backing backing, size_t size)
+{
+	size_t huge = (size + HPAGE_SIZE - 1) & -HPAGE_SIZE;
+
+	s->backing = backing;
+	s->size = size;
+	s->ptr = NULL;
+
+	switch (backing) {
+	case BO:
+		s->handle = gem_create(fd, size);
+		s->ptr = __gem_mmap__cpu(fd, s->handle, 0, size,
+					 PROT_READ | PROT_WRITE);
+		if (!s->ptr) {
+			gem_close(fd, s->handle);
+			return false;
+		}
+		gem_set_domain(fd, s->handle,
+			       I915_GEM_DOMAIN_CPU, I915_GEM_DOMAIN_CPU);
+		memset(s->ptr, 0x5a, size);
+		return true;
+	case USERPTR_4K:
+		s->ptr = aligned_alloc(HPAGE_SIZE, huge);
+		if (s->ptr)
+			madvise(s->ptr, huge, MADV_NOHUGEPAGE);
+		break;
+	case USERPTR_THP:
+		s->ptr = aligned_alloc(HPAGE_SIZE, huge);
+		if (s->ptr)
+			madvise(s->ptr, huge, MADV_HUGEPAGE);
+		break;
+	case USERPTR_HUGETLB:
+		s->ptr = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (s->ptr == MAP_FAILED)
+			s->ptr = NULL;
+		break;
+	default:
+		break;
+	}
+	if (!s->ptr)
+		return false;
+
+	memset(s->ptr, 0x5a, size);
+	if (__gem_userptr(fd, s->ptr, size, 0, 0, &s->handle)) {
+		if (backing == USERPTR_HUGETLB)
+			munmap(s->ptr, huge);
+		else
+			free(s->ptr);
+		return false;
+	}
+
+	return true;
+}
+
+static void surface_fini(int fd, struct surface *s)
+{
+	gem_close(fd, s->handle);
+
+	switch (s->backing) {
+	case BO:
+		munmap(s->ptr, s->size);
+		break;
+	case USERPTR_HUGETLB:
+		munmap(s->ptr, (s->size + HPAGE_SIZE - 1) & -HPAGE_SIZE);
+		break;
+	default:
+		free(s->ptr);
+		break;
+	}
+}
+
+/*
+ * Read one dword from every page in a random order, at an offset that walks
+ * through the page so the accesses do not all land in the same cache set.
+ */
+static double page_walk_ns(int fd, struct surface *s, const unsigned *order)
+{
+	unsigned pages = s->size / PAGE_SIZE;
+	volatile uint32_t *ptr = (volatile uint32_t *)s->ptr;
+	struct timespec start = {};
+	uint64_t elapsed;
+	uint32_t sum = 0;
+
+	if (s->backing == BO)
+		gem_set_domain(fd, s->handle, I915_GEM_DOMAIN_CPU, 0);
+
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++)
+		for (unsigned p = 0; p < pages; p++)
+			sum += ptr[((size_t)order[p] * PAGE_SIZE +
+				    (order[p] * 64 & (PAGE_SIZE - 1))) / 4];
+	elapsed = nsec_elapsed(&start);
+
+	assert(sum != 1); /* keep the loads */
+	return (double)elapsed / (LOOPS * pages);
+}
+
+static void shuffle(unsigned *order, unsigned count)
+{
+	for (unsigned n = 0; n < count; n++)
+		order[n] = n;
+	for (unsigned n = count - 1; n > 0; n--) {
+		unsigned r = random() % (n + 1);
+		unsigned tmp = order[n];
+
+		order[n] = order[r];
+		order[r] = tmp;
+	}
+}
+
+static void print_sysfs(const char *path)
+{
+	char buf[256] = "unknown\n";
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (file) {
+		if (!fgets(buf, sizeof(buf), file))
+			strcpy(buf, "unknown\n");
+		fclose(file);
+	}
+	printf("%s: %s", path, buf);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m max-size-MiB]\n"
+	       "  -m  sweep surface sizes from 2MiB to max-size (default 128,\n"
+	       "      less than 512)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t max_size = 128 << 20;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "m:h")) != -1) {
+		switch (c) {
+		case 'm':
+			max_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (max_size < HPAGE_SIZE || max_size > BLT_LINEAR_MAX_SIZE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	print_sysfs("/sys/kernel/mm/transparent_hugepage/enabled");
+	print_sysfs("/sys/kernel/mm/transparent_hugepage/shmem_enabled");
+	print_sysfs("/proc/sys/vm/nr_hugepages");
+
+	printf("%-16s %10s %8s %8s %10s %10s\n", "backing", "size(KiB)",
+	       "page(KiB)", "huge", "walk(ns)", "blit GB/s");
+	for (size_t size = HPAGE_SIZE; size <= max_size; size <<= 2) {
+		unsigned *order = calloc(size / PAGE_SIZE, sizeof(*order));
+		uint32_t dst = gem_create(fd, size);
+
+		assert(order);
+		shuffle(order, size / PAGE_SIZE);
+
+		for (enum backing b = 0; b < NUM_BACKINGS; b++) {
+			unsigned long rss_kb, huge_kb, page_kb;
+			struct surface s;
+			double walk, bw;
+
+			if (!surface_init(fd, &s, b, size)) {
+				printf("%-16s %10lu unavailable\n",
+				       backing_names[b], (unsigned long)(size >> 10));
+				continue;
+			}
+
+			walk = page_walk_ns(fd, &s, order);
+			bw = blit_bw(fd, s.handle, dst, size);
+
+			if (page_sizes(s.ptr, size, &rss_kb, &huge_kb, &page_kb))
+				printf("%-16s %10lu %8lu %7.0f%% %10.2f %10.2f\n",
+				       backing_names[b], (unsigned long)(size >> 10),
+				       page_kb, rss_kb ? 100.0 * huge_kb / rss_kb : 0,
+				       walk, bw);
+			else
+				printf("%-16s %10lu %8s %8s %10.2f %10.2f\n",
+				       backing_names[b], (unsigned long)(size >> 10),
+				       "?", "?", walk, bw);
+			fflush(stdout);
+
+			surface_fini(fd, &s);
+		}
+
+		gem_close(fd, dst);
+		free(order);
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Bandwidth of every memcpy_kernel into and out of WC and GTT mappings. With
+ * -a the kernels run on ordinary anonymous memory instead, which needs no
+ * gpu, and every copy and fill is checked at a range of misalignments first.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define TARGET_BYTES (1ull << 30)
+
+static void check_kernel(const struct memcpy_kernel *k)
+{
+	const size_t size = 16384;
+	unsigned char *a, *b;
+
+	a = aligned_alloc(4096, size + 128);
+	b = aligned_alloc(4096, size + 128);
+	assert(a && b);
+
+	for (unsigned off = 0; off < 64; off += 3) {
+		for (size_t len = 0; len < size; len = len * 3 + 1) {
+			for (size_t n = 0; n < size + 128; n++)
+				a[n] = n * 7 + off;
+
+			memset(b, 0xc5, size + 128);
+			k->to_wc(b + off, a + 64 - off, len);
+			assert(memcmp(b + off, a + 64 - off, len) == 0);
+			assert(b[off + len] == 0xc5);
+
+			memset(b, 0xc5, size + 128);
+			k->from_wc(b + 64 - off, a + off, len);
+			assert(memcmp(b + 64 - off, a + off, len) == 0);
+			assert(b[64 - off + len] == 0xc5);
+		}
+	}
+
+	/* fills are dword aligned and sized */
+	for (unsigned off = 0; off < 64; off += 4) {
+		for (size_t len = 0; len < size; len = (len * 3 + 4) & -4) {
+			uint32_t *d = (uint32_t *)(b + off);
+
+			memset(b, 0xc5, size + 128);
+			k->fill_wc(d, 0x12345678, len);
+			for (size_t n = 0; n < len / 4; n++)
+				assert(d[n] == 0x12345678);
+			assert(b[off + len] == 0xc5);
+		}
+	}
+
+	free(a);
+	free(b);
+}
+
+static double bandwidth(void *(*copy)(void *, const void *, size_t),
+			void *dst, const void *src, size_t size)
+{
+	unsigned passes = TARGET_BYTES / size;
+	struct timespec start = {};
+	uint64_t elapsed;
+
+	if (!passes)
+		passes = 1;
+
+	copy(dst, src, size);
+	nsec_elapsed(&start);
+	for (unsigned p = 0; p < passes; p++)
+		copy(dst, src, size);
+	elapsed = nsec_elapsed(&start);
+
+	return (double)passes * size / elapsed;
+}
+
+static void run(const char *type, char *map, char *buf, size_t size)
+{
+	const struct memcpy_kernel *k;
+
+	for (k = memcpy_kernels; k->name; k++) {
+		if (!k->supported()) {
+			printf("%-6s %-8s unsupported\n", type, k->name);
+			continue;
+		}
+
+		printf("%-6s %-8s %10.2f %10.2f\n", type, k->name,
+		       bandwidth(k->to_wc, map, buf, size),
+		       bandwidth(k->from_wc, buf, map, size));
+		fflush(stdout);
+	}
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-s size-KiB] [-a]\n"
+	       "  -s  size of each copy (default 16384)\n"
+	       "  -a  verify and time on anonymous memory, without a gpu\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = 16 << 20;
+	bool anon = false;
+	char *buf;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:ah")) != -1) {
+		switch (c) {
+		case 's':
+			size = strtoull(optarg, NULL, 0) << 10;
+			break;
+		case 'a':
+			anon = true;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!size) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	buf = aligned_alloc(4096, size);
+	assert(buf);
+	memset(buf, 0x5a, size);
+
+	printf("%-6s %-8s %10s %10s\n", "map", "kernel", "up(GB/s)", "down(GB/s)");
+	if (anon) {
+		const struct memcpy_kernel *k;
+		char *mem;
+
+		for (k = memcpy_kernels; k->name; k++)
+			if (k->supported())
+				check_kernel(k);
+
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_ANON | MAP_PRIVATE, -1, 0);
+		assert(mem != MAP_FAILED);
+		run("anon", mem, buf, size);
+		munmap(mem, size);
+	} else {
+		int fd = drm_open_driver(DRIVER_INTEL);
+		uint32_t handle = gem_create(fd, size);
+		char *map;
+
+		gem_set_domain(fd, handle, I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+		map = __gem_mmap__wc(fd, handle, 0, size, PROT_READ | PROT_WRITE);
+		if (map) {
+			run("wc", map, buf, size);
+			munmap(map, size);
+		}
+
+		map = __gem_mmap__gtt(fd, handle, size, PROT_READ | PROT_WRITE);
+		if (map) {
+			run("gtt", map, buf, size);
+			munmap(map, size);
+		}
+
+		gem_close(fd, handle);
+		close(fd);
+	}
+
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Scheduler fairness between contexts of different priority. Every context
+ * gets its own thread which keeps QUEUE_DEPTH batches from its duration mix
+ * in flight on the render engine and logs the submit and completion time of
+ * each one. From the logs we derive each context's share of the engine, the
+ * longest stretches it was starved while it had work queued, its latency
+ * percentiles, and how often it overtook work queued earlier by a context of
+ * higher priority (a priority inversion).
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+#include "intel_reg.h"
+
+#define MAX_CONTEXTS 16
+#define MAX_MIX 8
+/* Initial size of each log, doubled whenever a client fills it */
+#define LOG_REQUESTS (1 << 16)
+#define QUEUE_DEPTH 2
+
+struct request {
+	uint64_t submit;
+	uint64_t complete;
+	unsigned mix;
+};
+
+struct client {
+	pthread_t thread;
+	int fd;
+	unsigned ring;
+	int prio;
+	uint32_t ctx_id;
+
+	unsigned nmix;
+	unsigned kib[MAX_MIX];
+	uint32_t handle[MAX_MIX];
+	uint64_t duration[MAX_MIX];
+
+	struct timespec *epoch;
+	volatile bool *done;
+
+	struct request *req;
+	unsigned size;
+	unsigned count;
+	unsigned inversions;
+};
+
+static int submit(struct client *c, unsigned mix)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 exec;
+
+	memset(&exec, 0, sizeof(exec));
+	exec.handle = c->handle[mix];
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&exec;
+	execbuf.buffer_count = 1;
+	execbuf.flags = c->ring | I915_EXEC_FENCE_OUT;
+	execbuf.rsvd1 = c->ctx_id;
+	execbuf.rsvd2 = -1;
+	gem_execbuf_wr(c->fd, &execbuf);
+
+	return execbuf.rsvd2 >> 32;
+}
+
+static void *client_thread(void *data)
+{
+	struct client *c = data;
+	int fence[QUEUE_DEPTH];
+	unsigned head = 0, tail = 0;
+
+	while (!*c->done) {
+		if (tail - head < QUEUE_DEPTH) {
+			struct request *rq;
+
+			/* keep competing for the whole run, however fast */
+			if (tail == c->size) {
+				c->size *= 2;
+				c->req = realloc(c->req, c->size * sizeof(*c->req));
+				assert(c->req);
+			}
+			rq = &c->req[tail];
+
+			rq->mix = tail % c->nmix;
+			rq->submit = nsec_elapsed(c->epoch);
+			fence[tail % QUEUE_DEPTH] = submit(c, rq->mix);
+			tail++;
+			continue;
+		}
+
+		poll(&(struct pollfd){ fence[head % QUEUE_DEPTH], POLLIN }, 1, -1);
+		c->req[head].complete = nsec_elapsed(c->epoch);
+		close(fence[head % QUEUE_DEPTH]);
+		head++;
+	}
+
+	while (head < tail) {
+		poll(&(struct pollfd){ fence[head % QUEUE_DEPTH], POLLIN }, 1, -1);
+		c->req[head].complete = nsec_elapsed(c->epoch);
+		close(fence[head % QUEUE_DEPTH]);
+		head++;
+	}
+	c->count = tail;
+
+	return NULL;
+}
+
+/* Execution time of each batch in the mix on an idle engine */
+static void calibrate(struct client *c)
+{
+	for (unsigned m = 0; m < c->nmix; m++) {
+		struct timespec start = {};
+		int fence;
+
+		fence = submit(c, m);
+		poll(&(struct pollfd){ fence, POLLIN }, 1, -1);
+		close(fence);
+
+		nsec_elapsed(&start);
+		fence = submit(c, m);
+		poll(&(struct pollfd){ fence, POLLIN }, 1, -1);
+		c->duration[m] = nsec_elapsed(&start);
+		close(fence);
+	}
+}
+
+/*
+ * Count the requests of @lo that were submitted after, yet completed before,
+ * a request of the higher priority @hi. Both logs are in submission order and
+ * each context completes in order, so for every request of @lo the only
+ * candidate is the first request of @hi still incomplete at that time.
+ */
+static unsigned count_inversions(const struct client *lo, const struct client *hi)
+{
+	unsigned count = 0, h = 0;
+
+	for (unsigned l = 0; l < lo->count; l++) {
+		const struct request *rq = &lo->req[l];
+
+		while (h < hi->count && hi->req[h].complete <= rq->complete)
+			h++;
+		if (h < hi->count && hi->req[h].submit < rq->submit)
+			count++;
+	}
+
+	return count;
+}
+
+static void report(struct client *clients, unsigned nclients,
+		   uint64_t elapsed, uint64_t starve_ns)
+{
+	unsigned max_count = 0;
+	uint64_t *lat;
+
+	for (unsigned i = 0; i < nclients; i++)
+		if (clients[i].count > max_count)
+			max_count = clients[i].count;
+	lat = calloc(max_count ?: 1, sizeof(*lat));
+	assert(lat);
+
+	for (unsigned i = 0; i < nclients; i++) {
+		for (unsigned j = 0; j < nclients; j++)
+			if (clients[j].prio > clients[i].prio)
+				clients[i].inversions +=
+					count_inversions(&clients[i], &clients[j]);
+	}
+
+	printf("%4s %6s %8s %7s %10s %10s %10s %8s %10s %10s\n",
+	       "ctx", "prio", "batches", "share", "p50(us)", "p99(us)",
+	       "max(us)", "starved", "worst(ms)", "inversion");
+	for (unsigned i = 0; i < nclients; i++) {
+		struct client *c = &clients[i];
+		uint64_t busy = 0, worst = 0, last = 0;
+		unsigned starved = 0;
+
+		for (unsigned n = 0; n < c->count; n++) {
+			const struct request *rq = &c->req[n];
+			uint64_t gap;
+
+			lat[n] = rq->complete - rq->submit;
+			busy += c->duration[rq->mix];
+
+			/* the client always has work queued, so any gap
+			 * between completions is time spent waiting */
+			gap = rq->complete - (n ? last : rq->submit);
+			if (gap > c->duration[rq->mix] + starve_ns)
+				starved++;
+			if (gap > worst)
+				worst = gap;
+			last = rq->complete;
+		}
+		sort_u64(lat, c->count);
+
+		printf("%4u %6d %8u %6.1f%% %10.1f %10.1f %10.1f %8u %10.2f %10u\n",
+		       i, c->prio, c->count, 100.0 * busy / elapsed,
+		       percentile_u64(lat, c->count, 50) / 1000.0,
+		       percentile_u64(lat, c->count, 99) / 1000.0,
+		       c->count ? lat[c->count - 1] / 1000.0 : 0,
+		       starved, worst / 1e6, c->inversions);
+	}
+
+	free(lat);
+}
+
+/* "prio:kib[,kib...]" */
+static bool parse_client(struct client *c, const char *arg)
+{
+	char *end;
+
+	c->prio = strtol(arg, &end, 0);
+	if (*end != ':' ||
+	    c->prio < LOCAL_I915_CONTEXT_MIN_USER_PRIORITY ||
+	    c->prio > LOCAL_I915_CONTEXT_MAX_USER_PRIORITY)
+		return false;
+
+	c->nmix = 0;
+	do {
+		if (c->nmix == MAX_MIX)
+			return false;
+
+		c->kib[c->nmix] = strtoul(end + 1, &end, 0);
+		if (!c->kib[c->nmix])
+			return false;
+		c->nmix++;
+	} while (*end == ',');
+
+	return *end == '\0';
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-c prio:kib[,kib...]]... [-d seconds] [-s starve-ms] [-a arb-interval]\n"
+	       "  -c  add a context at prio cycling through batches of the given\n"
+	       "      sizes in KiB (default 1023:256 0:256,4096 -1023:4096)\n"
+	       "  -d  duration of the run (default 5)\n"
+	       "  -s  count a wait longer than a batch plus starve-ms as\n"
+	       "      starvation (default 10)\n"
+	       "  -a  dwords between MI_ARB_CHECK in each batch, 0 for none\n"
+	       "      (default 16)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *defaults[] = { "1023:256", "0:256,4096", "-1023:4096" };
+	struct client clients[MAX_CONTEXTS];
+	unsigned nclients = 0, arb_interval = 16;
+	struct timespec epoch = {};
+	volatile bool done = false;
+	uint64_t starve_ns = 10 * 1000 * 1000;
+	uint64_t elapsed;
+	int timeout = 5;
+	int fd, opt;
+
+	memset(clients, 0, sizeof(clients));
+	while ((opt = getopt(argc, argv, "c:d:s:a:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (nclients == MAX_CONTEXTS ||
+			    !parse_client(&clients[nclients++], optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'd':
+			timeout = atoi(optarg);
+			break;
+		case 's':
+			starve_ns = strtoull(optarg, NULL, 0) * 1000 * 1000;
+			break;
+		case 'a':
+			arb_interval = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!nclients) {
+		for (; nclients < 3; nclients++)
+			parse_client(&clients[nclients], defaults[nclients]);
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	for (unsigned i = 0; i < nclients; i++) {
+		struct client *c = &clients[i];
+
+		c->fd = fd;
+		c->ring = I915_EXEC_RENDER;
+		c->ctx_id = gem_context_create(fd);
+		__gem_context_set_priority(fd, c->ctx_id, c->prio);
+		for (unsigned m = 0; m < c->nmix; m++)
+			c->handle[m] = gem_nop_batch_create(fd, c->kib[m] << 10,
+							    arb_interval);
+		c->epoch = &epoch;
+		c->done = &done;
+		c->size = LOG_REQUESTS;
+		c->req = calloc(c->size, sizeof(*c->req));
+		assert(c->req);
+
+		calibrate(c);
+	}
+
+	nsec_elapsed(&epoch);
+	for (unsigned i = 0; i < nclients; i++)
+		assert(pthread_create(&clients[i].thread, NULL,
+				      client_thread, &clients[i]) == 0);
+	sleep(timeout);
+	done = true;
+	for (unsigned i = 0; i < nclients; i++)
+		pthread_join(clients[i].thread, NULL);
+	elapsed = nsec_elapsed(&epoch);
+
+	report(clients, nclients, elapsed, starve_ns);
+
+	for (unsigned i = 0; i < nclients; i++) {
+		struct client *c = &clients[i];
+
+		for (unsigned m = 0; m < c->nmix; m++)
+			gem_close(fd, c->handle[m]);
+		gem_context_destroy(fd, c->ctx_id);
+		free(c->req);
+	}
+	close(fd);
+	return 0;
+}
@@ -195,7 +195,7 @@ int main(int argc, char** argv)
 		int offset = (random() % size) & ~3;
 		int len = (random() % size) & ~3;
 		int first_page, last_page;
-		uint32_t *linear;
+		uint32_t *linear, *copy;
 		int j;
 
 		if (len == 0)
@@ -215,6 +215,12 @@ int main(int argc, char** argv)
 		linear = gem_mmap__wc(fd, handle, first_page, last_page - first_page, PROT_READ);
 		//linear = gem_mmap__cpu(fd, handle, first_page, last_page - first_page, PROT_READ);
 
+		/* Pull the window out of WC in one streaming copy rather than
+		 * a dword at a time */
+		copy = malloc(last_page - first_page);
+		assert(copy);
+		memcpy_from_wc(copy, linear, last_page - first_page);
+
 		/* Translate from offsets in the read buffer to the swizzled
 		 * address that it corresponds to.  This is the opposite of
 		 * what Mesa does (calculate offset to be read given the linear
@@ -224,11 +230,12 @@ int main(int argc, char** argv)
 			uint32_t expected_val, found_val;
 			int swizzled_offset = calc_swizzle_offset(swizzle, j);
 			expected_val = calculate_expected(swizzled_offset);
-			found_val = linear[(j - first_page)/ 4];
+			found_val = copy[(j - first_page)/ 4];
 			assert(expected_val == found_val);
 		}
 		printf(".");
 		fflush(NULL);
+		free(copy);
 		munmap(linear, last_page - first_page);
 	}
 	printf("\nSuccess!\n");
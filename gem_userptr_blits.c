@@ -0,0 +1,252 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Getting a frame from process memory to the gpu: blit straight out of a
+ * userptr wrapped around it, versus uploading it into a buffer object with
+ * PWRITE or a WC memcpy and blitting from there. Userptrs are tried on
+ * malloc'd memory, on transparent huge pages and on hugetlbfs, and the cost
+ * of wrapping and releasing the memory every frame is reported separately.
+ */
+
+#include <getopt.h>
+#include "gkit_lib.h"
+
+#define LOOPS 16
+
+enum backing { MALLOC, THP, HUGETLB, NUM_BACKINGS };
+static const char *backing_names[] = { "malloc", "thp", "hugetlb" };
+
+static unsigned userptr_flags;
+static int userptr_read_only;
+
+static void *alloc_backing(enum backing backing, size_t size)
+{
+	void *ptr;
+
+	switch (backing) {
+	case MALLOC:
+		return aligned_alloc(4096, size);
+	case THP:
+		ptr = aligned_alloc(2 << 20, (size + (2 << 20) - 1) & -(2 << 20));
+		if (ptr)
+			madvise(ptr, size, MADV_HUGEPAGE);
+		return ptr;
+	case HUGETLB:
+		ptr = mmap(NULL, (size + (2 << 20) - 1) & -(2 << 20),
+			   PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		return ptr == MAP_FAILED ? NULL : ptr;
+	default:
+		return NULL;
+	}
+}
+
+static void free_backing(enum backing backing, void *ptr, size_t size)
+{
+	if (backing == HUGETLB)
+		munmap(ptr, (size + (2 << 20) - 1) & -(2 << 20));
+	else
+		free(ptr);
+}
+
+static double gbps(uint64_t bytes, uint64_t ns)
+{
+	return (double)bytes / ns;
+}
+
+static void userptr_run(int fd, enum backing backing, uint32_t batch,
+			uint32_t dst, size_t size)
+{
+	uint64_t create = 0, destroy = 0, steady, frame;
+	struct timespec start;
+	uint32_t handle;
+	void *ptr;
+
+	ptr = alloc_backing(backing, size);
+	if (!ptr) {
+		printf("  %-16s unavailable\n", backing_names[backing]);
+		return;
+	}
+	memset(ptr, 0x5a, size);
+
+	if (__gem_userptr(fd, ptr, size, userptr_read_only,
+			  userptr_flags, &handle)) {
+		printf("  %-16s userptr rejected\n", backing_names[backing]);
+		free_backing(backing, ptr, size);
+		return;
+	}
+
+	/* one long-lived userptr, blitted every frame */
+	blt_linear_execbuf(fd, batch, handle, dst, size);
+	gem_sync(fd, dst);
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++)
+		blt_linear_execbuf(fd, batch, handle, dst, size);
+	gem_sync(fd, dst);
+	steady = nsec_elapsed(&start);
+	gem_close(fd, handle);
+
+	/* wrap the frame, blit it and release it, every frame */
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++) {
+		struct timespec t = {};
+
+		nsec_elapsed(&t);
+		gem_userptr(fd, ptr, size, userptr_read_only,
+			    userptr_flags, &handle);
+		create += nsec_elapsed(&t);
+
+		blt_linear_execbuf(fd, batch, handle, dst, size);
+		gem_sync(fd, dst);
+
+		memset(&t, 0, sizeof(t));
+		nsec_elapsed(&t);
+		gem_close(fd, handle);
+		destroy += nsec_elapsed(&t);
+	}
+	frame = nsec_elapsed(&start);
+
+	printf("  userptr-%-8s %10.2f %10.2f %12.2f %12.2f\n",
+	       backing_names[backing],
+	       gbps(LOOPS * size, steady), gbps(LOOPS * size, frame),
+	       create / LOOPS / 1000.0, destroy / LOOPS / 1000.0);
+	fflush(stdout);
+
+	free_backing(backing, ptr, size);
+}
+
+static void upload_run(int fd, bool wc, uint32_t batch,
+		       uint32_t dst, size_t size)
+{
+	struct timespec start = {};
+	uint64_t elapsed, blit_only;
+	uint32_t staging;
+	char *src, *map = NULL;
+
+	src = aligned_alloc(4096, size);
+	assert(src);
+	memset(src, 0x5a, size);
+
+	staging = gem_create(fd, size);
+	if (wc) {
+		map = __gem_mmap__wc(fd, staging, 0, size, PROT_WRITE);
+		if (!map) {
+			printf("  %-16s unavailable\n", "wc+blit");
+			goto out;
+		}
+	}
+
+	blt_linear_execbuf(fd, batch, staging, dst, size);
+	gem_sync(fd, dst);
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++)
+		blt_linear_execbuf(fd, batch, staging, dst, size);
+	gem_sync(fd, dst);
+	blit_only = nsec_elapsed(&start);
+
+	memset(&start, 0, sizeof(start));
+	nsec_elapsed(&start);
+	for (int n = 0; n < LOOPS; n++) {
+		if (wc) {
+			gem_set_domain(fd, staging,
+				       I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+			memcpy_to_wc(map, src, size);
+		} else {
+			gem_write(fd, staging, 0, src, size);
+		}
+		blt_linear_execbuf(fd, batch, staging, dst, size);
+		gem_sync(fd, dst);
+	}
+	elapsed = nsec_elapsed(&start);
+
+	printf("  %-16s %10.2f %10.2f\n", wc ? "wc+blit" : "pwrite+blit",
+	       gbps(LOOPS * size, blit_only), gbps(LOOPS * size, elapsed));
+	fflush(stdout);
+
+	if (map)
+		munmap(map, size);
+out:
+	gem_close(fd, staging);
+	free(src);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m max-size-MiB] [-r] [-u]\n"
+	       "  -m  sweep frame sizes from 64KiB to max-size (default 256,\n"
+	       "      less than 512)\n"
+	       "  -r  create read-only userptrs\n"
+	       "  -u  create unsynchronized userptrs (needs CAP_SYS_ADMIN)\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t max_size = 256 << 20;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "m:ruh")) != -1) {
+		switch (c) {
+		case 'm':
+			max_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'r':
+			userptr_read_only = 1;
+			break;
+		case 'u':
+			userptr_flags |= I915_USERPTR_UNSYNCHRONIZED;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (max_size < 64 << 10 || max_size > BLT_LINEAR_MAX_SIZE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = drm_open_driver(DRIVER_INTEL);
+
+	for (size_t size = 64 << 10; size <= max_size; size <<= 2) {
+		uint32_t dst = gem_create(fd, size);
+		uint32_t batch = blt_linear_batch_create(fd, size);
+
+		printf("%lu KiB:\n", (unsigned long)(size >> 10));
+		printf("  %-16s %10s %10s %12s %12s\n", "source",
+		       "blit GB/s", "frame GB/s", "create(us)", "destroy(us)");
+		for (enum backing b = 0; b < NUM_BACKINGS; b++)
+			userptr_run(fd, b, batch, dst, size);
+		upload_run(fd, false, batch, dst, size);
+		upload_run(fd, true, batch, dst, size);
+
+		gem_close(fd, batch);
+		gem_close(fd, dst);
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,920 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Workload simulator. A workload is a list of steps, one per line or
+ * separated by commas, which every client loops over:
+ *
+ *   <ctx>.<engine>.<us>[-<max-us>].<deps>.<wait>
+ *                     batch on context <ctx> (0..15) running for <us>, or a
+ *                     random time up to <max-us>, on RCS, BCS, VCS, VCS1,
+ *                     VCS2 or VECS. <deps> is 0 or a /-separated list of
+ *                     earlier steps, as negative offsets, whose batches must
+ *                     complete first. <wait> of 1 blocks the client until
+ *                     the batch completes.
+ *   d.<us>            sleep for <us>
+ *   p.<us>            sleep until <us> after the start of the iteration
+ *   s.<-n>            wait for the batch of step -n to complete
+ *   t.<n>             from here on keep at most <n> batches in flight
+ *   P.<ctx>.<prio>    set the priority of context <ctx>
+ *   #...              comment
+ *
+ * e.g. decode every 16ms, blit the result, render at high priority:
+ *
+ *   P.2.1023,0.VCS.3000.0.0,1.BCS.500.-1.0,2.RCS.2000.0.0,p.16000
+ *
+ * Batches are MI_NOOP buffers sized from a per-engine calibration, and their
+ * dependencies are expressed with sync_file in-fences. All execution goes
+ * through a backend: the i915 backend drives the GPU with one thread per
+ * client, while the fake backend (-n) replays the same scheduling against
+ * an in-process model of FIFO engines on a virtual clock, so workloads can
+ * be parsed and their schedules checked without any hardware.
+ */
+
+#include <getopt.h>
+#include <sys/stat.h>
+#include "gkit_lib.h"
+#include "intel_reg.h"
+
+#define MAX_CTX 16
+#define MAX_DEPS 4
+#define MAX_INFLIGHT 64
+#define MAX_SAMPLES (1 << 16)
+#define CALIBRATION_SIZE (4 << 20)
+
+enum step_type {
+	BATCH,
+	DELAY,
+	PERIOD,
+	SYNC,
+	THROTTLE,
+	PRIORITY,
+};
+
+static const struct {
+	const char *name;
+	unsigned flags;
+} engines[] = {
+	{ "RCS", I915_EXEC_RENDER },
+	{ "BCS", I915_EXEC_BLT },
+	{ "VCS", I915_EXEC_BSD },
+	{ "VCS1", I915_EXEC_BSD | 1 << 13 },
+	{ "VCS2", I915_EXEC_BSD | 2 << 13 },
+	{ "VECS", I915_EXEC_VEBOX },
+};
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+struct step {
+	enum step_type type;
+	unsigned ctx;
+	unsigned engine;
+	unsigned min_us, max_us;
+	int deps[MAX_DEPS];
+	unsigned ndeps;
+	bool wait;
+	int value; /* delay/period us, sync target, throttle, priority */
+};
+
+struct workload {
+	struct step *steps;
+	unsigned nsteps;
+	unsigned nctx;
+	unsigned engines; /* mask of engines used */
+};
+
+struct client;
+
+struct backend {
+	const char *name;
+	void (*init)(struct client *c);
+	void (*fini)(struct client *c);
+	void (*set_priority)(struct client *c, unsigned ctx, int prio);
+	/* returns a fence for the batch, owned by the caller */
+	int (*submit)(struct client *c, unsigned idx, uint64_t ns,
+		      const int *in, unsigned nin);
+	/* block until @fence completes, returns the completion time */
+	uint64_t (*wait)(struct client *c, int fence);
+	int (*dup)(struct client *c, int fence);
+	void (*release)(struct client *c, int fence);
+	void (*sleep_until)(struct client *c, uint64_t ns);
+	uint64_t (*now)(struct client *c);
+};
+
+struct client {
+	unsigned id;
+	const struct workload *wrk;
+	const struct backend *be;
+	pthread_t thread;
+	unsigned seed;
+
+	/* i915 backend */
+	int fd;
+	uint32_t ctx_id[MAX_CTX];
+	uint32_t *handle;
+	uint32_t *size;
+
+	/* fake backend */
+	uint64_t clock;
+
+	int *fence; /* latest fence of each step */
+	int inflight[MAX_INFLIGHT];
+	unsigned head, tail;
+	unsigned throttle;
+
+	unsigned step;
+	uint64_t iter_start;
+	unsigned iterations;
+	unsigned max_iterations;
+	uint64_t deadline;
+	bool finished;
+
+	uint64_t batches;
+	uint64_t *iter_ns;
+	uint64_t *sync_ns;
+	unsigned nsync;
+};
+
+static bool verbose;
+static struct timespec epoch;
+static uint64_t bytes_per_us[NUM_ENGINES];
+
+/* Parsing */
+
+static int parse_engine(const char *name)
+{
+	for (unsigned e = 0; e < NUM_ENGINES; e++)
+		if (!strcmp(engines[e].name, name))
+			return e;
+
+	return -1;
+}
+
+static bool parse_step(struct step *s, char *str)
+{
+	char *field[6];
+	unsigned n = 0;
+	char *end;
+
+	memset(s, 0, sizeof(*s));
+	while (n < 6 && (field[n] = strsep(&str, ".")))
+		n++;
+	if (str) /* too many fields */
+		return false;
+
+	if (!strcmp(field[0], "d") || !strcmp(field[0], "p")) {
+		s->type = *field[0] == 'd' ? DELAY : PERIOD;
+		if (n != 2)
+			return false;
+		s->value = strtol(field[1], &end, 0);
+		return !*end && s->value > 0;
+	}
+
+	if (!strcmp(field[0], "s")) {
+		s->type = SYNC;
+		if (n != 2)
+			return false;
+		s->value = strtol(field[1], &end, 0);
+		return !*end && s->value < 0;
+	}
+
+	if (!strcmp(field[0], "t")) {
+		s->type = THROTTLE;
+		if (n != 2)
+			return false;
+		s->value = strtol(field[1], &end, 0);
+		return !*end && s->value >= 0 && s->value <= MAX_INFLIGHT;
+	}
+
+	if (!strcmp(field[0], "P")) {
+		s->type = PRIORITY;
+		if (n != 3)
+			return false;
+		s->ctx = strtoul(field[1], &end, 0);
+		if (*end || s->ctx >= MAX_CTX)
+			return false;
+		s->value = strtol(field[2], &end, 0);
+		return !*end &&
+			s->value >= LOCAL_I915_CONTEXT_MIN_USER_PRIORITY &&
+			s->value <= LOCAL_I915_CONTEXT_MAX_USER_PRIORITY;
+	}
+
+	s->type = BATCH;
+	if (n != 5)
+		return false;
+
+	s->ctx = strtoul(field[0], &end, 0);
+	if (*end || s->ctx >= MAX_CTX)
+		return false;
+
+	if (parse_engine(field[1]) < 0)
+		return false;
+	s->engine = parse_engine(field[1]);
+
+	s->min_us = strtoul(field[2], &end, 0);
+	s->max_us = s->min_us;
+	if (*end == '-')
+		s->max_us = strtoul(end + 1, &end, 0);
+	if (*end || !s->min_us || s->max_us < s->min_us)
+		return false;
+
+	if (strcmp(field[3], "0")) {
+		char *dep, *deps = field[3];
+
+		while ((dep = strsep(&deps, "/"))) {
+			int d = strtol(dep, &end, 0);
+
+			if (*end || d >= 0 || s->ndeps == MAX_DEPS)
+				return false;
+			s->deps[s->ndeps++] = d;
+		}
+	}
+
+	if (strcmp(field[4], "0") && strcmp(field[4], "1"))
+		return false;
+	s->wait = *field[4] == '1';
+
+	return true;
+}
+
+static struct workload *parse_workload(const char *desc)
+{
+	struct workload *wrk;
+	char *buf, *str, *tok;
+	unsigned line = 0;
+
+	wrk = calloc(1, sizeof(*wrk));
+	assert(wrk);
+
+	buf = str = strdup(desc);
+	assert(buf);
+	while ((tok = strsep(&str, ",\n"))) {
+		struct step *s;
+
+		line++;
+		while (*tok == ' ' || *tok == '\t')
+			tok++;
+		if (!*tok || *tok == '#')
+			continue;
+
+		wrk->steps = realloc(wrk->steps,
+				     (wrk->nsteps + 1) * sizeof(*wrk->steps));
+		assert(wrk->steps);
+		s = &wrk->steps[wrk->nsteps];
+
+		if (!parse_step(s, tok)) {
+			fprintf(stderr, "Invalid step %u\n", line);
+			goto err;
+		}
+
+		if (s->type == BATCH || s->type == PRIORITY) {
+			if (s->ctx + 1 > wrk->nctx)
+				wrk->nctx = s->ctx + 1;
+		}
+		if (s->type == BATCH)
+			wrk->engines |= 1 << s->engine;
+
+		for (unsigned d = 0; d < s->ndeps; d++) {
+			if (-s->deps[d] > (int)wrk->nsteps ||
+			    s[s->deps[d]].type != BATCH) {
+				fprintf(stderr,
+					"Step %u depends on a non-batch step\n",
+					line);
+				goto err;
+			}
+		}
+		if (s->type == SYNC &&
+		    (-s->value > (int)wrk->nsteps || s[s->value].type != BATCH)) {
+			fprintf(stderr, "Step %u syncs on a non-batch step\n", line);
+			goto err;
+		}
+
+		wrk->nsteps++;
+	}
+	free(buf);
+
+	if (!wrk->nsteps) {
+		fprintf(stderr, "Empty workload\n");
+		free(wrk);
+		return NULL;
+	}
+
+	return wrk;
+
+err:
+	free(buf);
+	free(wrk->steps);
+	free(wrk);
+	return NULL;
+}
+
+static char *load_workload(const char *arg)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(arg, O_RDONLY);
+	if (fd < 0)
+		return strdup(arg);
+
+	assert(fstat(fd, &st) == 0);
+	buf = calloc(1, st.st_size + 1);
+	assert(buf);
+	assert(read(fd, buf, st.st_size) == st.st_size);
+	close(fd);
+
+	return buf;
+}
+
+/* i915 backend */
+
+static void i915_init(struct client *c)
+{
+	const struct workload *wrk = c->wrk;
+
+	for (unsigned n = 0; n < wrk->nctx; n++)
+		c->ctx_id[n] = gem_context_create(c->fd);
+
+	c->handle = calloc(wrk->nsteps, sizeof(*c->handle));
+	c->size = calloc(wrk->nsteps, sizeof(*c->size));
+	assert(c->handle && c->size);
+	for (unsigned i = 0; i < wrk->nsteps; i++) {
+		const struct step *s = &wrk->steps[i];
+
+		if (s->type != BATCH)
+			continue;
+
+		c->size[i] = (s->max_us * bytes_per_us[s->engine] + 8 + 4095) & ~4095;
+		c->handle[i] = gem_nop_batch_create(c->fd, c->size[i], 16);
+	}
+}
+
+static void i915_fini(struct client *c)
+{
+	for (unsigned i = 0; i < c->wrk->nsteps; i++) {
+		if (c->handle[i]) {
+			gem_sync(c->fd, c->handle[i]);
+			gem_close(c->fd, c->handle[i]);
+		}
+	}
+	for (unsigned n = 0; n < c->wrk->nctx; n++)
+		gem_context_destroy(c->fd, c->ctx_id[n]);
+
+	free(c->handle);
+	free(c->size);
+}
+
+static void i915_set_priority(struct client *c, unsigned ctx, int prio)
+{
+	__gem_context_set_priority(c->fd, c->ctx_id[ctx], prio);
+}
+
+static int i915_submit(struct client *c, unsigned idx, uint64_t ns,
+		       const int *in, unsigned nin)
+{
+	const struct step *s = &c->wrk->steps[idx];
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 exec;
+	uint64_t len;
+	int fence = -1;
+
+	/* Start part way into the MI_NOOP run to shorten the batch */
+	len = (ns * bytes_per_us[s->engine] / 1000 + 7) & ~7ull;
+	if (len > c->size[idx] - 8)
+		len = c->size[idx] - 8;
+
+	memset(&exec, 0, sizeof(exec));
+	exec.handle = c->handle[idx];
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)&exec;
+	execbuf.buffer_count = 1;
+	execbuf.batch_start_offset = c->size[idx] - 8 - len;
+	execbuf.flags = engines[s->engine].flags | I915_EXEC_FENCE_OUT;
+	execbuf.rsvd1 = c->ctx_id[s->ctx];
+	execbuf.rsvd2 = -1;
+
+	for (unsigned n = 0; n < nin; n++) {
+		if (fence < 0) {
+			fence = dup(in[n]);
+		} else {
+			int merged = sync_fence_merge(fence, in[n]);
+
+			assert(merged >= 0);
+			close(fence);
+			fence = merged;
+		}
+	}
+	if (fence >= 0) {
+		execbuf.flags |= I915_EXEC_FENCE_IN;
+		execbuf.rsvd2 = fence;
+	}
+
+	gem_execbuf_wr(c->fd, &execbuf);
+	if (fence >= 0)
+		close(fence);
+
+	fence = execbuf.rsvd2 >> 32;
+	assert(fence >= 0);
+	return fence;
+}
+
+static uint64_t i915_wait(struct client *c, int fence)
+{
+	poll(&(struct pollfd){ fence, POLLIN }, 1, -1);
+	return nsec_elapsed(&epoch);
+}
+
+static int i915_dup(struct client *c, int fence)
+{
+	return dup(fence);
+}
+
+static void i915_release(struct client *c, int fence)
+{
+	close(fence);
+}
+
+static uint64_t i915_now(struct client *c)
+{
+	return nsec_elapsed(&epoch);
+}
+
+static void i915_sleep_until(struct client *c, uint64_t ns)
+{
+	uint64_t now = i915_now(c);
+
+	if (ns > now)
+		usleep((ns - now) / 1000);
+}
+
+static const struct backend i915_backend = {
+	.name = "i915",
+	.init = i915_init,
+	.fini = i915_fini,
+	.set_priority = i915_set_priority,
+	.submit = i915_submit,
+	.wait = i915_wait,
+	.dup = i915_dup,
+	.release = i915_release,
+	.sleep_until = i915_sleep_until,
+	.now = i915_now,
+};
+
+/*
+ * Fake backend: in order engines on a virtual clock, fences index a table.
+ * Every execbuf costs the client FAKE_SUBMIT_NS of CPU time.
+ */
+
+#define FAKE_SUBMIT_NS 1000
+
+static uint64_t *fake_complete;
+static unsigned fake_nfences;
+static uint64_t fake_engine_idle[NUM_ENGINES];
+
+static void fake_init(struct client *c)
+{
+}
+
+static void fake_fini(struct client *c)
+{
+}
+
+static void fake_set_priority(struct client *c, unsigned ctx, int prio)
+{
+	if (verbose)
+		printf("%10.1fus client %u: ctx %u prio %d\n",
+		       c->clock / 1000.0, c->id, ctx, prio);
+}
+
+static int fake_submit(struct client *c, unsigned idx, uint64_t ns,
+		       const int *in, unsigned nin)
+{
+	const struct step *s = &c->wrk->steps[idx];
+	uint64_t start = c->clock;
+
+	if (start < fake_engine_idle[s->engine])
+		start = fake_engine_idle[s->engine];
+	for (unsigned n = 0; n < nin; n++)
+		if (start < fake_complete[in[n]])
+			start = fake_complete[in[n]];
+
+	if ((fake_nfences & (fake_nfences - 1)) == 0) {
+		fake_complete = realloc(fake_complete,
+					2 * (fake_nfences + 1) * sizeof(*fake_complete));
+		assert(fake_complete);
+	}
+	fake_complete[fake_nfences] = start + ns;
+	fake_engine_idle[s->engine] = start + ns;
+
+	if (verbose)
+		printf("%10.1fus client %u: step %u ctx %u %-4s %8.1fus, runs %.1f-%.1fus\n",
+		       c->clock / 1000.0, c->id, idx, s->ctx,
+		       engines[s->engine].name, ns / 1000.0,
+		       start / 1000.0, (start + ns) / 1000.0);
+	c->clock += FAKE_SUBMIT_NS;
+
+	return fake_nfences++;
+}
+
+static uint64_t fake_wait(struct client *c, int fence)
+{
+	if (c->clock < fake_complete[fence])
+		c->clock = fake_complete[fence];
+
+	return fake_complete[fence];
+}
+
+static int fake_dup(struct client *c, int fence)
+{
+	return fence;
+}
+
+static void fake_release(struct client *c, int fence)
+{
+}
+
+static void fake_sleep_until(struct client *c, uint64_t ns)
+{
+	if (c->clock < ns)
+		c->clock = ns;
+}
+
+static uint64_t fake_now(struct client *c)
+{
+	return c->clock;
+}
+
+static const struct backend fake_backend = {
+	.name = "fake",
+	.init = fake_init,
+	.fini = fake_fini,
+	.set_priority = fake_set_priority,
+	.submit = fake_submit,
+	.wait = fake_wait,
+	.dup = fake_dup,
+	.release = fake_release,
+	.sleep_until = fake_sleep_until,
+	.now = fake_now,
+};
+
+/* Execution */
+
+static int step_fence(struct client *c, int rel)
+{
+	return c->fence[c->step + rel];
+}
+
+static void run_batch(struct client *c, const struct step *s)
+{
+	const struct backend *be = c->be;
+	int in[MAX_DEPS];
+	unsigned nin = 0;
+	uint64_t ns, start;
+	int fence;
+
+	for (unsigned d = 0; d < s->ndeps; d++) {
+		int f = step_fence(c, s->deps[d]);
+
+		if (f >= 0)
+			in[nin++] = f;
+	}
+
+	if (c->throttle) {
+		while (c->tail - c->head >= c->throttle) {
+			be->wait(c, c->inflight[c->head % MAX_INFLIGHT]);
+			be->release(c, c->inflight[c->head % MAX_INFLIGHT]);
+			c->head++;
+		}
+	}
+
+	ns = s->min_us;
+	if (s->max_us > s->min_us)
+		ns += rand_r(&c->seed) % (s->max_us - s->min_us + 1);
+	ns *= 1000;
+
+	start = be->now(c);
+	fence = be->submit(c, c->step, ns, in, nin);
+	c->batches++;
+
+	if (c->throttle)
+		c->inflight[c->tail++ % MAX_INFLIGHT] = be->dup(c, fence);
+
+	if (c->fence[c->step] >= 0)
+		be->release(c, c->fence[c->step]);
+	c->fence[c->step] = fence;
+
+	if (s->wait) {
+		uint64_t done = be->wait(c, fence);
+
+		if (c->nsync < MAX_SAMPLES)
+			c->sync_ns[c->nsync++] = done - start;
+	}
+}
+
+/* Execute the next step of @c */
+static void client_step(struct client *c)
+{
+	const struct step *s = &c->wrk->steps[c->step];
+	const struct backend *be = c->be;
+
+	if (c->step == 0)
+		c->iter_start = be->now(c);
+
+	switch (s->type) {
+	case BATCH:
+		run_batch(c, s);
+		break;
+	case DELAY:
+		be->sleep_until(c, be->now(c) + s->value * 1000ull);
+		break;
+	case PERIOD:
+		be->sleep_until(c, c->iter_start + s->value * 1000ull);
+		break;
+	case SYNC: {
+		int f = step_fence(c, s->value);
+		uint64_t start = be->now(c);
+
+		if (f >= 0) {
+			uint64_t done = be->wait(c, f);
+
+			if (c->nsync < MAX_SAMPLES && done > start)
+				c->sync_ns[c->nsync++] = done - start;
+		}
+		break;
+	}
+	case THROTTLE:
+		c->throttle = s->value;
+		break;
+	case PRIORITY:
+		be->set_priority(c, s->ctx, s->value);
+		break;
+	}
+
+	if (++c->step == c->wrk->nsteps) {
+		if (c->iterations < MAX_SAMPLES)
+			c->iter_ns[c->iterations] = be->now(c) - c->iter_start;
+		c->iterations++;
+		c->step = 0;
+
+		if (c->iterations == c->max_iterations ||
+		    be->now(c) >= c->deadline)
+			c->finished = true;
+	}
+}
+
+static void client_drain(struct client *c)
+{
+	const struct backend *be = c->be;
+
+	while (c->head != c->tail)
+		be->release(c, c->inflight[c->head++ % MAX_INFLIGHT]);
+
+	for (unsigned i = 0; i < c->wrk->nsteps; i++) {
+		if (c->fence[i] >= 0) {
+			be->wait(c, c->fence[i]);
+			be->release(c, c->fence[i]);
+		}
+	}
+}
+
+static void *client_thread(void *data)
+{
+	struct client *c = data;
+
+	while (!c->finished)
+		client_step(c);
+
+	return NULL;
+}
+
+/*
+ * Discrete event loop for the fake backend: always advance the client that
+ * is furthest behind, so that submissions reach the engines in time order.
+ */
+static void run_fake(struct client *clients, unsigned nclients)
+{
+	for (;;) {
+		struct client *next = NULL;
+
+		for (unsigned n = 0; n < nclients; n++) {
+			struct client *c = &clients[n];
+
+			if (!c->finished && (!next || c->clock < next->clock))
+				next = c;
+		}
+		if (!next)
+			break;
+
+		client_step(next);
+	}
+}
+
+static void calibrate(int fd, unsigned mask)
+{
+	for (unsigned e = 0; e < NUM_ENGINES; e++) {
+		struct drm_i915_gem_execbuffer2 execbuf;
+		struct drm_i915_gem_exec_object2 exec;
+		struct timespec start = {};
+		uint64_t elapsed;
+
+		if (!(mask & (1 << e)))
+			continue;
+
+		memset(&exec, 0, sizeof(exec));
+		exec.handle = gem_nop_batch_create(fd, CALIBRATION_SIZE, 16);
+
+		memset(&execbuf, 0, sizeof(execbuf));
+		execbuf.buffers_ptr = (uint64_t)&exec;
+		execbuf.buffer_count = 1;
+		execbuf.flags = engines[e].flags;
+
+		gem_execbuf(fd, &execbuf);
+		gem_sync(fd, exec.handle);
+
+		nsec_elapsed(&start);
+		gem_execbuf(fd, &execbuf);
+		gem_sync(fd, exec.handle);
+		elapsed = nsec_elapsed(&start) / 1000;
+
+		bytes_per_us[e] = CALIBRATION_SIZE / (elapsed ? elapsed : 1);
+		if (!bytes_per_us[e])
+			bytes_per_us[e] = 1;
+		gem_close(fd, exec.handle);
+
+		if (verbose)
+			printf("%s: %lu bytes/us\n", engines[e].name,
+			       (unsigned long)bytes_per_us[e]);
+	}
+}
+
+static void report(struct client *clients, unsigned nclients, uint64_t elapsed)
+{
+	uint64_t iterations = 0, batches = 0;
+
+	printf("%6s %8s %9s %10s %10s %10s %10s %10s\n",
+	       "client", "iters", "iters/s", "batches/s",
+	       "iter-p50", "iter-p99", "sync-p50", "sync-p99");
+	for (unsigned n = 0; n < nclients; n++) {
+		struct client *c = &clients[n];
+		unsigned count = c->iterations < MAX_SAMPLES ?
+			c->iterations : MAX_SAMPLES;
+
+		sort_u64(c->iter_ns, count);
+		sort_u64(c->sync_ns, c->nsync);
+		printf("%6u %8u %9.1f %10.1f %8.2fms %8.2fms %8.2fms %8.2fms\n",
+		       n, c->iterations,
+		       c->iterations * 1e9 / elapsed,
+		       c->batches * 1e9 / elapsed,
+		       percentile_u64(c->iter_ns, count, 50) / 1e6,
+		       percentile_u64(c->iter_ns, count, 99) / 1e6,
+		       percentile_u64(c->sync_ns, c->nsync, 50) / 1e6,
+		       percentile_u64(c->sync_ns, c->nsync, 99) / 1e6);
+
+		iterations += c->iterations;
+		batches += c->batches;
+	}
+	printf("%6s %8lu %9.1f %10.1f\n", "total", (unsigned long)iterations,
+	       iterations * 1e9 / elapsed, batches * 1e9 / elapsed);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s -w <workload|file> [-c clients] [-r repeats] [-d seconds] [-n] [-v]\n"
+	       "  -w  workload description, or a file containing one\n"
+	       "  -c  number of clients each looping over the workload (default 1)\n"
+	       "  -r  iterations per client (default: until -d expires)\n"
+	       "  -d  maximum duration in seconds (default 10)\n"
+	       "  -n  run on the fake in-process backend instead of the GPU\n"
+	       "  -v  trace the schedule\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct backend *be = &i915_backend;
+	struct workload *wrk = NULL;
+	struct client *clients;
+	unsigned nclients = 1, repeats = 0;
+	uint64_t elapsed;
+	int timeout = 10;
+	int fd = -1, c;
+
+	while ((c = getopt(argc, argv, "w:c:r:d:nvh")) != -1) {
+		switch (c) {
+		case 'w': {
+			char *desc = load_workload(optarg);
+
+			wrk = parse_workload(desc);
+			free(desc);
+			if (!wrk)
+				return 1;
+			break;
+		}
+		case 'c':
+			nclients = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'd':
+			timeout = atoi(optarg);
+			break;
+		case 'n':
+			be = &fake_backend;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!wrk || !nclients || timeout < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (be == &i915_backend) {
+		fd = drm_open_driver(DRIVER_INTEL);
+		calibrate(fd, wrk->engines);
+	}
+
+	clients = calloc(nclients, sizeof(*clients));
+	assert(clients);
+	for (unsigned n = 0; n < nclients; n++) {
+		struct client *cl = &clients[n];
+
+		cl->id = n;
+		cl->wrk = wrk;
+		cl->be = be;
+		cl->fd = fd;
+		cl->seed = n + 1;
+		cl->max_iterations = repeats;
+		cl->deadline = (uint64_t)timeout * NSEC_PER_SEC;
+		cl->fence = malloc(wrk->nsteps * sizeof(*cl->fence));
+		cl->iter_ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+		cl->sync_ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+		assert(cl->fence && cl->iter_ns && cl->sync_ns);
+		for (unsigned i = 0; i < wrk->nsteps; i++)
+			cl->fence[i] = -1;
+
+		be->init(cl);
+	}
+
+	nsec_elapsed(&epoch);
+	if (be == &fake_backend) {
+		run_fake(clients, nclients);
+	} else {
+		for (unsigned n = 0; n < nclients; n++)
+			assert(pthread_create(&clients[n].thread, NULL,
+					      client_thread, &clients[n]) == 0);
+		for (unsigned n = 0; n < nclients; n++)
+			pthread_join(clients[n].thread, NULL);
+	}
+
+	elapsed = 0;
+	for (unsigned n = 0; n < nclients; n++) {
+		client_drain(&clients[n]);
+		if (be->now(&clients[n]) > elapsed)
+			elapsed = be->now(&clients[n]);
+	}
+	if (!elapsed)
+		elapsed = 1;
+
+	report(clients, nclients, elapsed);
+
+	for (unsigned n = 0; n < nclients; n++) {
+		be->fini(&clients[n]);
+		free(clients[n].fence);
+		free(clients[n].iter_ns);
+		free(clients[n].sync_ns);
+	}
+	free(clients);
+	free(wrk->steps);
+	free(wrk);
+	if (fd >= 0)
+		close(fd);
+	return 0;
+}
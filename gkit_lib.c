@@ -21,6 +21,17 @@
  * IN THE SOFTWARE.
  */
 #include "gkit_lib.h"
+#include "intel_reg.h"
+#include <math.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define HAVE_X86 1
+#endif
 
 const struct intel_execution_engine intel_execution_engines[] = {
 	{ "default", NULL, 0, 0 },
@@ -56,6 +67,26 @@ int __gem_execbuf_wr(int fd, struct drm_i915_gem_execbuffer2 *execbuf)
 	return err;
 }
 
+int sync_fence_merge(int fence1, int fence2)
+{
+    struct local_sync_merge_data {
+        char name[32];
+        int32_t fd2;
+        int32_t fence;
+        uint32_t flags;
+        uint32_t pad;
+    } arg;
+#define LOCAL_SYNC_IOC_MERGE _IOWR('>', 3, struct local_sync_merge_data)
+
+    memset(&arg, 0, sizeof(arg));
+    strcpy(arg.name, "gkit merge");
+    arg.fd2 = fence2;
+    if (ioctl(fence1, LOCAL_SYNC_IOC_MERGE, &arg))
+        return -errno;
+
+    return arg.fence;
+}
+
 int syncobj_destroy(int fd, uint32_t handle)
 {
     struct local_syncobj_destroy {
@@ -121,6 +152,41 @@ int __gem_context_set_priority(int fd, uint32_t ctx_id, int prio)
 	return __gem_context_set_param(fd, &p);
 }
 
+#define LOCAL_I915_CONTEXT_PARAM_VM 0x9
+
+struct local_i915_gem_vm_control {
+	uint64_t extensions;
+	uint32_t flags;
+	uint32_t vm_id;
+};
+
+#define LOCAL_IOCTL_I915_GEM_VM_DESTROY \
+	DRM_IOW(DRM_COMMAND_BASE + 0x3b, struct local_i915_gem_vm_control)
+
+int __gem_context_share_vm(int fd, uint32_t ctx_id, uint32_t src_id)
+{
+	struct drm_i915_gem_context_param p;
+	struct local_i915_gem_vm_control ctl;
+	int err;
+
+	memset(&p, 0, sizeof(p));
+	p.ctx_id = src_id;
+	p.param = LOCAL_I915_CONTEXT_PARAM_VM;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_GETPARAM, &p))
+		return -errno;
+
+	p.ctx_id = ctx_id;
+	err = __gem_context_set_param(fd, &p);
+
+	/* the id is only a handle, the context holds its own reference */
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.vm_id = p.value;
+	drmIoctl(fd, LOCAL_IOCTL_I915_GEM_VM_DESTROY, &ctl);
+
+	errno = 0;
+	return err;
+}
+
 int __gem_context_create(int fd, uint32_t *ctx_id)
 {
        struct drm_i915_gem_context_create create;
@@ -156,6 +222,73 @@ void gem_context_destroy(int fd, uint32_t ctx_id)
     drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_DESTROY, &destroy);
 }
 
+static uint32_t gem_context_create_priority(int fd, int prio)
+{
+	uint32_t ctx_id = gem_context_create(fd);
+
+	if (prio != LOCAL_I915_CONTEXT_DEFAULT_PRIORITY)
+		__gem_context_set_priority(fd, ctx_id, prio);
+
+	return ctx_id;
+}
+
+struct gem_context_pool *gem_context_pool_create(int fd, unsigned int count, int prio)
+{
+	struct gem_context_pool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	assert(pool);
+
+	pool->fd = fd;
+	pool->prio = prio;
+	pool->size = count ? count : 1;
+	pool->ctx = calloc(pool->size, sizeof(*pool->ctx));
+	assert(pool->ctx);
+	pthread_mutex_init(&pool->lock, NULL);
+
+	while (pool->count < count)
+		pool->ctx[pool->count++] = gem_context_create_priority(fd, prio);
+
+	return pool;
+}
+
+uint32_t gem_context_pool_get(struct gem_context_pool *pool)
+{
+	uint32_t ctx_id = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->count)
+		ctx_id = pool->ctx[--pool->count];
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!ctx_id)
+		ctx_id = gem_context_create_priority(pool->fd, pool->prio);
+
+	return ctx_id;
+}
+
+void gem_context_pool_put(struct gem_context_pool *pool, uint32_t ctx_id)
+{
+	pthread_mutex_lock(&pool->lock);
+	if (pool->count == pool->size) {
+		pool->size *= 2;
+		pool->ctx = realloc(pool->ctx, pool->size * sizeof(*pool->ctx));
+		assert(pool->ctx);
+	}
+	pool->ctx[pool->count++] = ctx_id;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void gem_context_pool_destroy(struct gem_context_pool *pool)
+{
+	while (pool->count)
+		gem_context_destroy(pool->fd, pool->ctx[--pool->count]);
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->ctx);
+	free(pool);
+}
+
 uint64_t gem_aperture_size(int fd)
 {
     static uint64_t aperture_size = 0;
@@ -216,6 +349,8 @@ void *__gem_mmap__gtt(int fd, uint32_t handle, uint64_t size, unsigned prot)
 		return NULL;
 
 	ptr = mmap(0, size, prot, MAP_SHARED, fd, mmap_arg.offset);
+	if (ptr == MAP_FAILED)
+		ptr = NULL;
 	return ptr;
 }
 
@@ -249,6 +384,28 @@ void *gem_mmap__wc(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsi
     return ptr;
 }
 
+void *__gem_mmap__cpu(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsigned prot)
+{
+    struct drm_i915_gem_mmap arg;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.handle = handle;
+    arg.offset = offset;
+    arg.size = size;
+    if (drmIoctl(fd, DRM_IOCTL_I915_GEM_MMAP, &arg))
+        return NULL;
+
+    errno = 0;
+    return (void *)arg.addr_ptr;
+}
+
+void *gem_mmap__cpu(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsigned prot)
+{
+    void *ptr = __gem_mmap__cpu(fd, handle, offset, size, prot);
+    assert(ptr);
+    return ptr;
+}
+
 int gem_wait(int fd, uint32_t handle, int64_t *timeout_ns)
 {
 	struct drm_i915_gem_wait wait;
@@ -375,6 +532,37 @@ void gem_set_tiling(int fd, uint32_t handle, uint32_t tiling, uint32_t stride)
     assert(__gem_set_tiling(fd, handle, tiling, stride) == 0);
 }
 
+int __gem_set_caching(int fd, uint32_t handle, uint32_t caching)
+{
+	struct drm_i915_gem_caching arg;
+	int err = 0;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.handle = handle;
+	arg.caching = caching;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_SET_CACHING, &arg))
+		err = -errno;
+
+	errno = 0;
+	return err;
+}
+
+void gem_set_caching(int fd, uint32_t handle, uint32_t caching)
+{
+	assert(__gem_set_caching(fd, handle, caching) == 0);
+}
+
+uint32_t gem_get_caching(int fd, uint32_t handle)
+{
+	struct drm_i915_gem_caching arg;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.handle = handle;
+	assert(drmIoctl(fd, DRM_IOCTL_I915_GEM_GET_CACHING, &arg) == 0);
+
+	return arg.caching;
+}
+
 static int __gem_create(int fd, uint64_t size, uint32_t *handle)
 {
 	struct drm_i915_gem_create create = {
@@ -422,6 +610,55 @@ void gem_write(int fd, uint32_t handle, uint64_t offset, const void *buf, uint64
 	assert(__gem_write(fd, handle, offset, buf, length)==0);
 }
 
+static int __gem_read(int fd, uint32_t handle, uint64_t offset, void *buf, uint64_t length)
+{
+	struct drm_i915_gem_pread gem_pread;
+	int err;
+
+	memset(&gem_pread, 0, sizeof(gem_pread));
+	gem_pread.handle = handle;
+	gem_pread.offset = offset;
+	gem_pread.size = length;
+	gem_pread.data_ptr = (uint64_t)buf;
+
+	err = 0;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_PREAD, &gem_pread))
+		err = -errno;
+	return err;
+}
+
+void gem_read(int fd, uint32_t handle, uint64_t offset, void *buf, uint64_t length)
+{
+	assert(__gem_read(fd, handle, offset, buf, length)==0);
+}
+
+int __gem_userptr(int fd, void *ptr, uint64_t size, int read_only, uint32_t flags, uint32_t *handle)
+{
+	struct drm_i915_gem_userptr userptr;
+	int err;
+
+	memset(&userptr, 0, sizeof(userptr));
+	userptr.user_ptr = (uint64_t)ptr;
+	userptr.user_size = size;
+	userptr.flags = flags;
+	if (read_only)
+		userptr.flags |= I915_USERPTR_READ_ONLY;
+
+	err = 0;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_USERPTR, &userptr))
+		err = -errno;
+	else
+		*handle = userptr.handle;
+
+	errno = 0;
+	return err;
+}
+
+void gem_userptr(int fd, void *ptr, uint64_t size, int read_only, uint32_t flags, uint32_t *handle)
+{
+	assert(__gem_userptr(fd, ptr, size, read_only, flags, handle) == 0);
+}
+
 int __gem_execbuf(int fd, struct drm_i915_gem_execbuffer2 *execbuf)
 {
 	int err = 0;
@@ -435,3 +672,1526 @@ void gem_execbuf(int fd, struct drm_i915_gem_execbuffer2 *execbuf)
 {
 	assert(__gem_execbuf(fd, execbuf)==0);
 }
+
+uint32_t gem_nop_batch_create(int fd, uint64_t size, unsigned int arb_interval)
+{
+	uint32_t *cs;
+	uint32_t handle;
+	uint64_t len, n;
+
+	size = (size + 4095) & ~4095ull;
+	len = size / sizeof(uint32_t);
+	assert(len >= 2);
+
+	cs = calloc(len, sizeof(uint32_t)); /* MI_NOOP == 0 */
+	assert(cs);
+
+	if (arb_interval)
+		for (n = arb_interval; n < len - 2; n += arb_interval)
+			cs[n] = MI_ARB_CHECK;
+	cs[len - 2] = MI_BATCH_BUFFER_END;
+
+	handle = gem_create(fd, size);
+	gem_write(fd, handle, 0, cs, size);
+	free(cs);
+
+	return handle;
+}
+
+/* Tiled pitches are programmed in dwords, linear ones in bytes */
+static uint32_t blt_pitch(const struct blt_surface *s)
+{
+	return s->tiling != I915_TILING_NONE ? s->pitch / 4 : s->pitch;
+}
+
+static uint32_t *blt_emit_surfaces(const uint32_t *batch, uint32_t *b,
+				   struct drm_i915_gem_relocation_entry *reloc,
+				   const struct blt_surface *src,
+				   const struct blt_surface *dst,
+				   uint32_t width, uint32_t height)
+{
+	memset(reloc, 0, 2 * sizeof(*reloc));
+
+	*b++ = dst->y << 16 | dst->x;
+	*b++ = (dst->y + height) << 16 | (dst->x + width);
+	reloc[0].offset = (b - batch) * sizeof(uint32_t);
+	reloc[0].target_handle = dst->handle;
+	reloc[0].read_domains = I915_GEM_DOMAIN_RENDER;
+	reloc[0].write_domain = I915_GEM_DOMAIN_RENDER;
+	*b++ = 0;
+	*b++ = 0;
+
+	*b++ = src->y << 16 | src->x;
+	*b++ = blt_pitch(src);
+	reloc[1].offset = (b - batch) * sizeof(uint32_t);
+	reloc[1].target_handle = src->handle;
+	reloc[1].read_domains = I915_GEM_DOMAIN_RENDER;
+	*b++ = 0;
+	*b++ = 0;
+
+	return b;
+}
+
+uint32_t *blt_src_copy(const uint32_t *batch, uint32_t *b,
+		       struct drm_i915_gem_relocation_entry *reloc,
+		       const struct blt_surface *src,
+		       const struct blt_surface *dst,
+		       uint32_t width, uint32_t height)
+{
+	uint32_t cmd = XY_SRC_COPY_BLT_CMD |
+		       XY_SRC_COPY_BLT_WRITE_ALPHA |
+		       XY_SRC_COPY_BLT_WRITE_RGB | 8;
+	uint32_t swctrl = 0;
+
+	if (src->tiling > I915_TILING_Y || dst->tiling > I915_TILING_Y)
+		return NULL;
+
+	if (src->tiling != I915_TILING_NONE)
+		cmd |= XY_SRC_COPY_BLT_SRC_TILED;
+	if (dst->tiling != I915_TILING_NONE)
+		cmd |= XY_SRC_COPY_BLT_DST_TILED;
+	if (src->tiling == I915_TILING_Y)
+		swctrl |= BCS_SRC_Y;
+	if (dst->tiling == I915_TILING_Y)
+		swctrl |= BCS_DST_Y;
+
+	if (swctrl) {
+		*b++ = MI_LOAD_REGISTER_IMM;
+		*b++ = BCS_SWCTRL;
+		*b++ = (BCS_SRC_Y | BCS_DST_Y) << 16 | swctrl;
+	}
+
+	*b++ = cmd;
+	*b++ = 3 << 24 | 0xcc << 16 | blt_pitch(dst);
+	b = blt_emit_surfaces(batch, b, reloc, src, dst, width, height);
+
+	if (swctrl) {
+		*b++ = MI_LOAD_REGISTER_IMM;
+		*b++ = BCS_SWCTRL;
+		*b++ = (BCS_SRC_Y | BCS_DST_Y) << 16;
+	}
+
+	return b;
+}
+
+static uint32_t fast_copy_tiling(uint32_t tiling, bool dst)
+{
+	switch (tiling) {
+	case I915_TILING_X:
+		return dst ? XY_FAST_COPY_DST_TILING_X : XY_FAST_COPY_SRC_TILING_X;
+	case I915_TILING_Y:
+	case I915_TILING_Yf:
+		return dst ? XY_FAST_COPY_DST_TILING_Yb_Yf : XY_FAST_COPY_SRC_TILING_Yb_Yf;
+	case I915_TILING_Ys:
+		return dst ? XY_FAST_COPY_DST_TILING_Ys : XY_FAST_COPY_SRC_TILING_Ys;
+	default:
+		return 0;
+	}
+}
+
+uint32_t *blt_fast_copy(const uint32_t *batch, uint32_t *b,
+			struct drm_i915_gem_relocation_entry *reloc,
+			const struct blt_surface *src,
+			const struct blt_surface *dst,
+			uint32_t width, uint32_t height)
+{
+	uint32_t dword1 = XY_FAST_COPY_COLOR_DEPTH_32;
+
+	if (src->tiling == I915_TILING_Yf)
+		dword1 |= XY_FAST_COPY_SRC_TILING_Yf;
+	if (dst->tiling == I915_TILING_Yf)
+		dword1 |= XY_FAST_COPY_DST_TILING_Yf;
+
+	*b++ = XY_FAST_COPY_BLT |
+	       fast_copy_tiling(src->tiling, false) |
+	       fast_copy_tiling(dst->tiling, true);
+	*b++ = dword1 | blt_pitch(dst);
+	return blt_emit_surfaces(batch, b, reloc, src, dst, width, height);
+}
+
+uint32_t *blt_fill(const uint32_t *batch, uint32_t *b,
+		   struct drm_i915_gem_relocation_entry *reloc,
+		   const struct blt_surface *dst, unsigned int bpp,
+		   uint32_t width, uint32_t height, uint32_t color)
+{
+	uint32_t cmd = XY_COLOR_BLT_CMD_NOLEN | 5;
+	uint32_t depth;
+
+	switch (bpp) {
+	case 8:
+		depth = 0;
+		break;
+	case 16:
+		depth = 1;
+		break;
+	case 32:
+		depth = 3;
+		cmd |= XY_COLOR_BLT_WRITE_ALPHA | XY_COLOR_BLT_WRITE_RGB;
+		break;
+	default:
+		return NULL;
+	}
+
+	if (dst->tiling > I915_TILING_Y)
+		return NULL;
+	if (dst->tiling != I915_TILING_NONE)
+		cmd |= XY_COLOR_BLT_TILED;
+
+	if (dst->tiling == I915_TILING_Y) {
+		*b++ = MI_LOAD_REGISTER_IMM;
+		*b++ = BCS_SWCTRL;
+		*b++ = BCS_DST_Y << 16 | BCS_DST_Y;
+	}
+
+	*b++ = cmd;
+	*b++ = depth << 24 | 0xf0 << 16 | blt_pitch(dst);
+	*b++ = dst->y << 16 | dst->x;
+	*b++ = (dst->y + height) << 16 | (dst->x + width);
+	memset(reloc, 0, sizeof(*reloc));
+	reloc->offset = (b - batch) * sizeof(uint32_t);
+	reloc->target_handle = dst->handle;
+	reloc->read_domains = I915_GEM_DOMAIN_RENDER;
+	reloc->write_domain = I915_GEM_DOMAIN_RENDER;
+	*b++ = 0;
+	*b++ = 0;
+	*b++ = color;
+
+	if (dst->tiling == I915_TILING_Y) {
+		*b++ = MI_LOAD_REGISTER_IMM;
+		*b++ = BCS_SWCTRL;
+		*b++ = BCS_DST_Y << 16;
+	}
+
+	return b;
+}
+
+int blt_linear_copy(uint32_t *batch,
+		    struct drm_i915_gem_relocation_entry *reloc,
+		    uint32_t src, uint32_t dst, uint64_t size)
+{
+	uint32_t pitch = size < BLT_LINEAR_PITCH ? size : BLT_LINEAR_PITCH;
+	uint64_t height = size / pitch;
+	struct blt_surface s = { .handle = src, .pitch = pitch };
+	struct blt_surface d = { .handle = dst, .pitch = pitch };
+	uint32_t *b;
+
+	assert(pitch % 4 == 0 && size % pitch == 0);
+	assert(height <= BLT_MAX_ROWS);
+
+	b = blt_src_copy(batch, batch, reloc, &s, &d, pitch / 4, height);
+	*b++ = MI_BATCH_BUFFER_END;
+	if ((b - batch) & 1)
+		*b++ = 0;
+
+	return (b - batch) * sizeof(uint32_t);
+}
+
+uint32_t blt_linear_batch_create(int fd, uint64_t size)
+{
+	struct drm_i915_gem_relocation_entry reloc[2];
+	uint32_t batch[16];
+	uint32_t handle;
+	int len;
+
+	handle = gem_create(fd, 4096);
+	len = blt_linear_copy(batch, reloc, 0, 0, size);
+	gem_write(fd, handle, 0, batch, len);
+
+	return handle;
+}
+
+void blt_linear_execbuf(int fd, uint32_t batch, uint32_t src, uint32_t dst,
+			uint64_t size)
+{
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 obj[3];
+	struct drm_i915_gem_relocation_entry reloc[2];
+	uint32_t cs[16];
+	int len;
+
+	len = blt_linear_copy(cs, reloc, src, dst, size);
+
+	memset(obj, 0, sizeof(obj));
+	obj[0].handle = src;
+	obj[1].handle = dst;
+	obj[2].handle = batch;
+	obj[2].relocs_ptr = (uint64_t)reloc;
+	obj[2].relocation_count = 2;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uint64_t)obj;
+	execbuf.buffer_count = 3;
+	execbuf.batch_len = len;
+	execbuf.flags = I915_EXEC_BLT;
+	gem_execbuf(fd, &execbuf);
+}
+
+static int __u64cmp(const void *A, const void *B)
+{
+	const uint64_t *a = A, *b = B;
+
+	if (*a < *b)
+		return -1;
+	else if (*a > *b)
+		return 1;
+	else
+		return 0;
+}
+
+void sort_u64(uint64_t *v, unsigned int count)
+{
+	qsort(v, count, sizeof(*v), __u64cmp);
+}
+
+uint64_t percentile_u64(const uint64_t *sorted, unsigned int count, double pct)
+{
+	unsigned int idx;
+
+	if (!count)
+		return 0;
+
+	idx = pct * count / 100;
+	if (idx >= count)
+		idx = count - 1;
+
+	return sorted[idx];
+}
+
+/* Bytes staged per bounce: one cacheline for each of the cpu's fill buffers */
+#define WC_FILL_BUFFERS 10
+#define WC_BOUNCE_SIZE (WC_FILL_BUFFERS * 64)
+
+static bool memcpy_generic_supported(void)
+{
+	return true;
+}
+
+static void *memcpy_generic(void *dst, const void *src, size_t len)
+{
+	return memcpy(dst, src, len);
+}
+
+static void *fill_generic(void *dst, uint32_t pattern, size_t len)
+{
+	uint32_t *d = dst;
+
+	for (; len >= 4; len -= 4)
+		*d++ = pattern;
+
+	return dst;
+}
+
+#ifdef HAVE_X86
+static bool memcpy_sse2_supported(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool memcpy_sse41_supported(void)
+{
+	return __builtin_cpu_supports("sse4.1");
+}
+
+static bool memcpy_avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool memcpy_avx512_supported(void)
+{
+	return __builtin_cpu_supports("avx512f");
+}
+
+/*
+ * Each kernel copies the unaligned head and tail with memcpy() and streams
+ * the rest with the widest vectors the instruction set offers.
+ */
+#define DEFINE_TO_WC(name, isa, width, vec, loadu, stream)		\
+__attribute__((target(isa)))						\
+static void *memcpy_to_wc_##name(void *dst, const void *src, size_t len) \
+{									\
+	char *d = dst;							\
+	const char *s = src;						\
+	size_t head = -(uintptr_t)d & (width - 1);			\
+									\
+	if (head > len)							\
+		head = len;						\
+	memcpy(d, s, head);						\
+	d += head, s += head, len -= head;				\
+									\
+	for (; len >= 4 * width; len -= 4 * width) {			\
+		vec a = loadu((const vec *)s + 0);			\
+		vec b = loadu((const vec *)s + 1);			\
+		vec c = loadu((const vec *)s + 2);			\
+		vec e = loadu((const vec *)s + 3);			\
+		stream((vec *)d + 0, a);				\
+		stream((vec *)d + 1, b);				\
+		stream((vec *)d + 2, c);				\
+		stream((vec *)d + 3, e);				\
+		d += 4 * width, s += 4 * width;				\
+	}								\
+	for (; len >= width; len -= width) {				\
+		stream((vec *)d, loadu((const vec *)s));		\
+		d += width, s += width;					\
+	}								\
+	_mm_sfence();							\
+									\
+	memcpy(d, s, len);						\
+	return dst;							\
+}
+
+#define DEFINE_FROM_WC(name, isa, width, vec, sload, store)		\
+__attribute__((target(isa)))						\
+static void *memcpy_from_wc_##name(void *dst, const void *src, size_t len) \
+{									\
+	vec bounce[WC_BOUNCE_SIZE / width];				\
+	char *d = dst;							\
+	const char *s = src;						\
+	size_t head = -(uintptr_t)s & (width - 1);			\
+									\
+	if (head > len)							\
+		head = len;						\
+	memcpy(d, s, head);						\
+	d += head, s += head, len -= head;				\
+									\
+	/* order the streaming loads after earlier stores, once */	\
+	_mm_mfence();							\
+	while (len >= width) {						\
+		size_t chunk = len < WC_BOUNCE_SIZE ? len : WC_BOUNCE_SIZE; \
+		unsigned n = chunk / width;				\
+									\
+		for (unsigned i = 0; i < n; i++)			\
+			bounce[i] = sload((vec *)s + i);		\
+		for (unsigned i = 0; i < n; i++)			\
+			store((vec *)d + i, bounce[i]);			\
+		d += n * width, s += n * width, len -= n * width;	\
+	}								\
+									\
+	memcpy(d, s, len);						\
+	return dst;							\
+}
+
+/* As DEFINE_TO_WC, with dword stores for the unaligned head and tail */
+#define DEFINE_FILL_WC(name, isa, width, vec, set1, stream)		\
+__attribute__((target(isa)))						\
+static void *fill_wc_##name(void *dst, uint32_t pattern, size_t len)	\
+{									\
+	uint32_t *d = dst;						\
+	vec v = set1((int)pattern);					\
+									\
+	for (; len >= 4 && (uintptr_t)d & (width - 1); len -= 4)	\
+		*d++ = pattern;						\
+									\
+	for (; len >= 4 * width; len -= 4 * width) {			\
+		stream((vec *)d + 0, v);				\
+		stream((vec *)d + 1, v);				\
+		stream((vec *)d + 2, v);				\
+		stream((vec *)d + 3, v);				\
+		d += width;						\
+	}								\
+	for (; len >= width; len -= width) {				\
+		stream((vec *)d, v);					\
+		d += width / 4;						\
+	}								\
+	_mm_sfence();							\
+									\
+	for (; len >= 4; len -= 4)					\
+		*d++ = pattern;						\
+	return dst;							\
+}
+
+DEFINE_TO_WC(sse2, "sse2", 16, __m128i, _mm_loadu_si128, _mm_stream_si128)
+DEFINE_TO_WC(avx2, "avx2", 32, __m256i, _mm256_loadu_si256, _mm256_stream_si256)
+DEFINE_TO_WC(avx512, "avx512f", 64, __m512i, _mm512_loadu_si512, _mm512_stream_si512)
+
+DEFINE_FROM_WC(sse41, "sse4.1", 16, __m128i, _mm_stream_load_si128, _mm_storeu_si128)
+DEFINE_FROM_WC(avx2, "avx2", 32, __m256i, _mm256_stream_load_si256, _mm256_storeu_si256)
+DEFINE_FROM_WC(avx512, "avx512f", 64, __m512i, _mm512_stream_load_si512, _mm512_storeu_si512)
+
+DEFINE_FILL_WC(sse2, "sse2", 16, __m128i, _mm_set1_epi32, _mm_stream_si128)
+DEFINE_FILL_WC(avx2, "avx2", 32, __m256i, _mm256_set1_epi32, _mm256_stream_si256)
+DEFINE_FILL_WC(avx512, "avx512f", 64, __m512i, _mm512_set1_epi32, _mm512_stream_si512)
+#endif
+
+const struct memcpy_kernel memcpy_kernels[] = {
+	{ "memcpy", memcpy_generic_supported, memcpy_generic, memcpy_generic,
+	  fill_generic },
+#ifdef HAVE_X86
+	{ "sse2", memcpy_sse2_supported, memcpy_to_wc_sse2, memcpy_generic,
+	  fill_wc_sse2 },
+	{ "sse4.1", memcpy_sse41_supported, memcpy_to_wc_sse2, memcpy_from_wc_sse41,
+	  fill_wc_sse2 },
+	{ "avx2", memcpy_avx2_supported, memcpy_to_wc_avx2, memcpy_from_wc_avx2,
+	  fill_wc_avx2 },
+	{ "avx512", memcpy_avx512_supported, memcpy_to_wc_avx512, memcpy_from_wc_avx512,
+	  fill_wc_avx512 },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static const struct memcpy_kernel *memcpy_best(void)
+{
+	static const struct memcpy_kernel *best;
+
+	if (!best) {
+		const struct memcpy_kernel *k;
+
+		for (k = memcpy_kernels; k->name; k++)
+			if (k->supported())
+				best = k;
+	}
+
+	return best;
+}
+
+void *memcpy_to_wc(void *dst, const void *src, size_t len)
+{
+	return memcpy_best()->to_wc(dst, src, len);
+}
+
+void *memcpy_from_wc(void *dst, const void *src, size_t len)
+{
+	return memcpy_best()->from_wc(dst, src, len);
+}
+
+void *fill_to_wc(void *dst, uint32_t pattern, size_t len)
+{
+	return memcpy_best()->fill_wc(dst, pattern, len);
+}
+
+#define CACHELINE_SIZE 64
+
+#ifdef HAVE_X86
+enum { FLUSH_CLFLUSH, FLUSH_CLFLUSHOPT, FLUSH_CLWB };
+
+static unsigned int cpu_flush_features(void)
+{
+	static int features = -1;
+
+	if (features < 0) {
+		unsigned int eax, ebx, ecx, edx;
+
+		features = 0;
+		if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+			if (ebx & bit_CLFLUSHOPT)
+				features |= 1 << FLUSH_CLFLUSHOPT;
+			if (ebx & bit_CLWB)
+				features |= 1 << FLUSH_CLWB;
+		}
+	}
+
+	return features;
+}
+
+__attribute__((target("sse2")))
+static void flush_clflush(char *p, const char *end)
+{
+	/* clflush is ordered against other clflushes and the stores before it */
+	_mm_mfence();
+	for (; p < end; p += CACHELINE_SIZE)
+		_mm_clflush(p);
+	_mm_mfence();
+}
+
+__attribute__((target("clflushopt,sse2")))
+static void flush_clflushopt(char *p, const char *end)
+{
+	for (; p < end; p += CACHELINE_SIZE)
+		_mm_clflushopt(p);
+	_mm_mfence();
+}
+
+__attribute__((target("clwb,sse2")))
+static void flush_clwb(char *p, const char *end)
+{
+	for (; p < end; p += CACHELINE_SIZE)
+		_mm_clwb(p);
+	_mm_mfence();
+}
+#endif
+
+void cpu_cache_flush(void *ptr, size_t len, bool invalidate)
+{
+#ifdef HAVE_X86
+	char *p = (char *)((uintptr_t)ptr & -CACHELINE_SIZE);
+	const char *end = (const char *)ptr + len;
+	unsigned int features = cpu_flush_features();
+
+	if (!len)
+		return;
+
+	if (!invalidate && features & 1 << FLUSH_CLWB)
+		flush_clwb(p, end);
+	else if (features & 1 << FLUSH_CLFLUSHOPT)
+		flush_clflushopt(p, end);
+	else
+		flush_clflush(p, end);
+#else
+	__sync_synchronize();
+#endif
+}
+
+const char *cpu_cache_flush_name(bool invalidate)
+{
+#ifdef HAVE_X86
+	unsigned int features = cpu_flush_features();
+
+	if (!invalidate && features & 1 << FLUSH_CLWB)
+		return "clwb";
+	if (features & 1 << FLUSH_CLFLUSHOPT)
+		return "clflushopt";
+	return "clflush";
+#else
+	return "none";
+#endif
+}
+
+/* One gen9+ frequency unit is 50/3 MHz, so reads round by up to 17 */
+#define GPU_FREQ_SLACK 17
+#define GPU_FREQ_SETTLE_READS 3
+#define GPU_FREQ_POLL_US 1000
+#define GPU_FREQ_LOAD_SIZE (1 << 20)
+
+int sysfs_open(struct sysfs_dir *d, const char *root)
+{
+	int card;
+
+	memset(d, 0, sizeof(*d));
+	if (root) {
+		snprintf(d->root, sizeof(d->root), "%s", root);
+		return 0;
+	}
+
+	card = drm_get_card();
+	if (card < 0)
+		return -ENODEV;
+	snprintf(d->root, sizeof(d->root), "/sys/class/drm/card%d", card);
+	return 0;
+}
+
+void sysfs_close(struct sysfs_dir *d)
+{
+	for (unsigned int i = 0; i < d->nattr; i++) {
+		close(d->attr[i].rd);
+		if (d->attr[i].wr >= 0)
+			close(d->attr[i].wr);
+	}
+	d->nattr = 0;
+}
+
+int sysfs_attr(struct sysfs_dir *d, const char *name)
+{
+	char path[256];
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < d->nattr; i++)
+		if (!strcmp(d->attr[i].name, name))
+			return i;
+
+	if (d->nattr == SYSFS_MAX_ATTRS ||
+	    strlen(name) >= sizeof(d->attr[0].name))
+		return -ENOSPC;
+
+	snprintf(path, sizeof(path), "%s/%s", d->root, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	snprintf(d->attr[i].name, sizeof(d->attr[i].name), "%s", name);
+	d->attr[i].rd = fd;
+	d->attr[i].wr = -1;
+	return d->nattr++;
+}
+
+int64_t sysfs_read(struct sysfs_dir *d, int attr)
+{
+	char buf[32];
+	ssize_t len;
+
+	/* sysfs regenerates the contents on every read from offset 0 */
+	len = pread(d->attr[attr].rd, buf, sizeof(buf) - 1, 0);
+	if (len < 0)
+		return -errno;
+
+	buf[len] = '\0';
+	return strtoll(buf, NULL, 0);
+}
+
+int sysfs_read_batch(struct sysfs_dir *d, const int *attr, int64_t *values,
+		     unsigned int count)
+{
+	int err = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		values[i] = sysfs_read(d, attr[i]);
+		if (values[i] < 0 && !err)
+			err = values[i];
+	}
+
+	return err;
+}
+
+int sysfs_write(struct sysfs_dir *d, int attr, int value)
+{
+	char buf[32];
+	ssize_t len;
+
+	if (d->attr[attr].wr < 0) {
+		char path[256];
+
+		snprintf(path, sizeof(path), "%s/%s",
+			 d->root, d->attr[attr].name);
+		d->attr[attr].wr = open(path, O_WRONLY);
+		if (d->attr[attr].wr < 0)
+			return -errno;
+	}
+
+	/* the newline ends the value, whatever a fake tree leaves after it */
+	len = snprintf(buf, sizeof(buf), "%d\n", value);
+	if (pwrite(d->attr[attr].wr, buf, len, 0) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int gpu_freq_read(struct gpu_freq *f, const char *name)
+{
+	int attr = sysfs_attr(&f->sysfs, name);
+
+	return attr < 0 ? attr : sysfs_read(&f->sysfs, attr);
+}
+
+int gpu_freq_write(struct gpu_freq *f, const char *name, int value)
+{
+	int attr = sysfs_attr(&f->sysfs, name);
+
+	return attr < 0 ? attr : sysfs_write(&f->sysfs, attr, value);
+}
+
+int gpu_freq_open(struct gpu_freq *f, const char *root, int step)
+{
+	unsigned int count;
+	int err;
+
+	memset(f, 0, sizeof(*f));
+	err = sysfs_open(&f->sysfs, root);
+	if (err)
+		return err;
+
+	f->act = sysfs_attr(&f->sysfs, "gt_act_freq_mhz");
+	f->min = gpu_freq_read(f, "gt_min_freq_mhz");
+	f->max = gpu_freq_read(f, "gt_max_freq_mhz");
+	f->rpn = gpu_freq_read(f, "gt_RPn_freq_mhz");
+	f->rp0 = gpu_freq_read(f, "gt_RP0_freq_mhz");
+	if (f->act < 0)
+		err = f->act;
+	else if (f->min < 0)
+		err = f->min;
+	else if (f->max < 0)
+		err = f->max;
+	else if (f->rpn < 0)
+		err = f->rpn;
+	else if (f->rp0 < 0)
+		err = f->rp0;
+	else if (f->rp0 < f->rpn)
+		err = -EINVAL;
+	if (err) {
+		sysfs_close(&f->sysfs);
+		return err;
+	}
+
+	f->rp1 = gpu_freq_read(f, "gt_RP1_freq_mhz");
+	if (f->rp1 < 0)
+		f->rp1 = 0;
+
+	if (step <= 0)
+		step = GPU_FREQ_STEP;
+	count = (f->rp0 - f->rpn + step - 1) / step + 1;
+	f->steps = calloc(count, sizeof(*f->steps));
+	if (!f->steps) {
+		sysfs_close(&f->sysfs);
+		return -ENOMEM;
+	}
+
+	for (int mhz = f->rpn; mhz < f->rp0; mhz += step)
+		f->steps[f->nsteps++] = mhz;
+	f->steps[f->nsteps++] = f->rp0;
+
+	return 0;
+}
+
+void gpu_freq_close(struct gpu_freq *f)
+{
+	if (f->steps)
+		gpu_freq_set(f, f->min, f->max);
+	free(f->steps);
+	f->steps = NULL;
+	f->nsteps = 0;
+	sysfs_close(&f->sysfs);
+}
+
+int gpu_freq_set(struct gpu_freq *f, int min, int max)
+{
+	int cur = gpu_freq_read(f, "gt_max_freq_mhz");
+	int err;
+
+	if (cur < 0)
+		return cur;
+
+	if (min > cur) {
+		err = gpu_freq_write(f, "gt_max_freq_mhz", max);
+		if (!err)
+			err = gpu_freq_write(f, "gt_min_freq_mhz", min);
+	} else {
+		err = gpu_freq_write(f, "gt_min_freq_mhz", min);
+		if (!err)
+			err = gpu_freq_write(f, "gt_max_freq_mhz", max);
+	}
+
+	return err;
+}
+
+/* Nop batches kept queued on the render engine, to hold the gpu out of rc6 */
+struct gpu_load {
+	int fd;
+	struct drm_i915_gem_exec_object2 obj;
+	struct drm_i915_gem_execbuffer2 execbuf;
+};
+
+static void gpu_load_init(struct gpu_load *l, int fd)
+{
+	memset(l, 0, sizeof(*l));
+	l->fd = fd;
+	if (fd < 0)
+		return;
+
+	l->obj.handle = gem_nop_batch_create(fd, GPU_FREQ_LOAD_SIZE, 0);
+	l->execbuf.buffers_ptr = (uint64_t)&l->obj;
+	l->execbuf.buffer_count = 1;
+}
+
+static void gpu_load_poll(struct gpu_load *l)
+{
+	if (l->obj.handle && !gem_bo_busy(l->fd, l->obj.handle))
+		gem_execbuf(l->fd, &l->execbuf);
+}
+
+static void gpu_load_fini(struct gpu_load *l)
+{
+	if (!l->obj.handle)
+		return;
+
+	gem_sync(l->fd, l->obj.handle);
+	gem_close(l->fd, l->obj.handle);
+}
+
+int gpu_freq_settle(struct gpu_freq *f, int fd, int mhz, unsigned int timeout_ms)
+{
+	struct timespec start = {};
+	struct gpu_load load;
+	unsigned int stable = 0;
+	int act;
+
+	gpu_load_init(&load, fd);
+
+	nsec_elapsed(&start);
+	do {
+		gpu_load_poll(&load);
+
+		act = sysfs_read(&f->sysfs, f->act);
+		if (act < 0)
+			break;
+
+		if (abs(act - mhz) <= GPU_FREQ_SLACK)
+			stable++;
+		else
+			stable = 0;
+		if (stable == GPU_FREQ_SETTLE_READS)
+			break;
+
+		usleep(GPU_FREQ_POLL_US);
+	} while (nsec_elapsed(&start) < (uint64_t)timeout_ms * 1000000);
+
+	gpu_load_fini(&load);
+
+	if (act < 0)
+		return act;
+	return stable == GPU_FREQ_SETTLE_READS ? act : -ETIMEDOUT;
+}
+
+#define GPU_FREQ_SETTLE_MS 1000
+
+int gpu_freq_sweep(struct gpu_freq *f, int fd,
+		   void (*func)(int mhz, int act, void *data), void *data)
+{
+	int err = 0;
+
+	for (unsigned int i = 0; i < f->nsteps; i++) {
+		int mhz = f->steps[i];
+
+		err = gpu_freq_set(f, mhz, mhz);
+		if (err)
+			break;
+
+		func(mhz, gpu_freq_settle(f, fd, mhz, GPU_FREQ_SETTLE_MS), data);
+	}
+
+	gpu_freq_set(f, f->min, f->max);
+	return err;
+}
+
+int i915_pmu_type(void)
+{
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	fd = open("/sys/bus/event_source/devices/i915/type", O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -ENODEV;
+
+	buf[len] = '\0';
+	return atoi(buf);
+}
+
+int i915_pmu_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	int type = i915_pmu_type();
+	int fd;
+
+	if (type < 0)
+		return type;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = type;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	if (group < 0)
+		attr.read_format = PERF_FORMAT_GROUP;
+
+	fd = syscall(__NR_perf_event_open, &attr, -1, 0, group, 0);
+	return fd < 0 ? -errno : fd;
+}
+
+void pmu_group_init(struct pmu_group *g)
+{
+	memset(g, 0, sizeof(*g));
+	g->leader = -1;
+}
+
+int pmu_group_add(struct pmu_group *g, const char *name, uint64_t config)
+{
+	struct pmu_event *e = &g->event[g->nevent];
+
+	if (g->nevent == PMU_MAX_EVENTS)
+		return -ENOSPC;
+
+	e->fd = i915_pmu_open(config, g->leader);
+	if (e->fd < 0)
+		return e->fd;
+
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->config = config;
+	if (g->leader < 0)
+		g->leader = e->fd;
+
+	return g->nevent++;
+}
+
+int pmu_group_add_all(struct pmu_group *g)
+{
+	static const struct {
+		const char *name;
+		uint8_t class, instances;
+	} engines[] = {
+		{ "rcs", LOCAL_I915_ENGINE_CLASS_RENDER, 1 },
+		{ "bcs", LOCAL_I915_ENGINE_CLASS_COPY, 1 },
+		{ "vcs", LOCAL_I915_ENGINE_CLASS_VIDEO, 8 },
+		{ "vecs", LOCAL_I915_ENGINE_CLASS_VIDEO_ENHANCE, 4 },
+	};
+	static const struct {
+		const char *name;
+		uint64_t config;
+	} others[] = {
+		{ "actual-frequency", LOCAL_I915_PMU_ACTUAL_FREQUENCY },
+		{ "requested-frequency", LOCAL_I915_PMU_REQUESTED_FREQUENCY },
+		{ "interrupts", LOCAL_I915_PMU_INTERRUPTS },
+		{ "rc6-residency", LOCAL_I915_PMU_RC6_RESIDENCY },
+	};
+	static const char *samples[] = {
+		[LOCAL_I915_SAMPLE_BUSY] = "busy",
+		[LOCAL_I915_SAMPLE_WAIT] = "wait",
+		[LOCAL_I915_SAMPLE_SEMA] = "sema",
+	};
+	char name[32];
+	int err = i915_pmu_type();
+
+	if (err < 0)
+		return err;
+
+	for (unsigned int i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+		for (unsigned int n = 0; n < engines[i].instances; n++) {
+			for (unsigned int x = 0; x < sizeof(samples) / sizeof(samples[0]); x++) {
+				snprintf(name, sizeof(name), "%s%u-%s",
+					 engines[i].name, n, samples[x]);
+				err = pmu_group_add(g, name,
+						    LOCAL_I915_PMU_ENGINE(engines[i].class,
+									  n, x));
+				/* no busy counter, no such engine */
+				if (err < 0 && x == LOCAL_I915_SAMPLE_BUSY)
+					break;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < sizeof(others) / sizeof(others[0]); i++)
+		err = pmu_group_add(g, others[i].name, others[i].config);
+
+	return g->nevent ? (int)g->nevent : err;
+}
+
+int pmu_group_find(const struct pmu_group *g, const char *name)
+{
+	for (unsigned int i = 0; i < g->nevent; i++)
+		if (!strcmp(g->event[i].name, name))
+			return i;
+
+	return -ENOENT;
+}
+
+int pmu_group_read(const struct pmu_group *g, struct pmu_sample *s)
+{
+	/* PERF_FORMAT_GROUP: { nr, value[nr] } */
+	uint64_t buf[1 + PMU_MAX_EVENTS];
+	ssize_t len = (1 + g->nevent) * sizeof(uint64_t);
+	ssize_t ret;
+
+	ret = read(g->leader, buf, len);
+	if (ret < 0)
+		return -errno;
+	if (ret != len)
+		return -EIO;
+
+	s->time = sampler_now();
+	memcpy(s->value, buf + 1, g->nevent * sizeof(uint64_t));
+	return 0;
+}
+
+void pmu_group_rates(const struct pmu_group *g, const struct pmu_sample *start,
+		     const struct pmu_sample *end, double *rates)
+{
+	uint64_t elapsed = end->time - start->time;
+
+	for (unsigned int i = 0; i < g->nevent; i++)
+		rates[i] = elapsed ? (double)(end->value[i] - start->value[i]) *
+				     NSEC_PER_SEC / elapsed : NAN;
+}
+
+void pmu_group_close(struct pmu_group *g)
+{
+	/* the leader last, it carries the group */
+	while (g->nevent)
+		close(g->event[--g->nevent].fd);
+	g->leader = -1;
+}
+
+uint64_t sampler_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int sampler_init(struct sampler *s, unsigned int size, unsigned int interval_us)
+{
+	unsigned int pow2 = 1;
+
+	while (pow2 < size)
+		pow2 <<= 1;
+
+	memset(s, 0, sizeof(*s));
+	pmu_group_init(&s->pmu);
+	s->interval_ns = (uint64_t)interval_us * 1000;
+	s->size = pow2;
+	s->ring = calloc(pow2, sizeof(*s->ring));
+	s->scratch = calloc(pow2, sizeof(*s->scratch));
+	if (!s->ring || !s->scratch) {
+		free(s->ring);
+		free(s->scratch);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static struct sampler_channel *
+sampler_add(struct sampler *s, const char *name, enum sampler_kind kind)
+{
+	struct sampler_channel *c;
+
+	if (s->running || s->nchannel == SAMPLER_MAX_CHANNELS)
+		return NULL;
+
+	c = &s->channel[s->nchannel];
+	memset(c, 0, sizeof(*c));
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->kind = kind;
+	c->pmu = -1;
+	return c;
+}
+
+int sampler_add_sysfs(struct sampler *s, struct sysfs_dir *d,
+		      const char *name, enum sampler_kind kind)
+{
+	struct sampler_channel *c = sampler_add(s, name, kind);
+
+	if (!c)
+		return -ENOSPC;
+
+	c->attr = sysfs_attr(d, name);
+	if (c->attr < 0)
+		return c->attr;
+	c->sysfs = d;
+
+	return s->nchannel++;
+}
+
+int sampler_add_pmu(struct sampler *s, const char *name, uint64_t config)
+{
+	struct sampler_channel *c = sampler_add(s, name, SAMPLER_COUNTER);
+
+	if (!c)
+		return -ENOSPC;
+
+	c->pmu = pmu_group_add(&s->pmu, name, config);
+	if (c->pmu < 0)
+		return c->pmu;
+
+	return s->nchannel++;
+}
+
+int sampler_add_counter(struct sampler *s, const char *name,
+			uint64_t (*read)(void *data), void *data,
+			enum sampler_kind kind)
+{
+	struct sampler_channel *c = sampler_add(s, name, kind);
+
+	if (!c)
+		return -ENOSPC;
+
+	c->read = read;
+	c->data = data;
+
+	return s->nchannel++;
+}
+
+static int64_t sampler_read_channel(struct sampler_channel *c,
+				    const struct pmu_sample *pmu, int pmu_err)
+{
+	if (c->sysfs)
+		return sysfs_read(c->sysfs, c->attr);
+
+	if (c->pmu >= 0)
+		return pmu_err ?: (int64_t)pmu->value[c->pmu];
+
+	return c->read(c->data);
+}
+
+void sampler_poll(struct sampler *s)
+{
+	uint64_t n = s->head;
+	struct sampler_sample *x = &s->ring[n & (s->size - 1)];
+	struct pmu_sample pmu;
+	int pmu_err = 0;
+
+	/* as a seqlock: claim the slot before touching it */
+	__atomic_store_n(&s->claimed, n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	x->time = sampler_now();
+	if (s->pmu.nevent)
+		pmu_err = pmu_group_read(&s->pmu, &pmu);
+	for (unsigned int i = 0; i < s->nchannel; i++)
+		x->value[i] = sampler_read_channel(&s->channel[i],
+						   &pmu, pmu_err);
+
+	__atomic_store_n(&s->head, n + 1, __ATOMIC_RELEASE);
+}
+
+static void *sampler_thread(void *arg)
+{
+	struct sampler *s = arg;
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+		uint64_t deadline;
+
+		sampler_poll(s);
+
+		/* keep to the grid, but do not burst to catch up */
+		deadline = (uint64_t)next.tv_sec * NSEC_PER_SEC + next.tv_nsec;
+		deadline += s->interval_ns;
+		if (deadline < sampler_now())
+			deadline = sampler_now();
+		next.tv_sec = deadline / NSEC_PER_SEC;
+		next.tv_nsec = deadline % NSEC_PER_SEC;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return NULL;
+}
+
+int sampler_start(struct sampler *s)
+{
+	int err;
+
+	if (s->running)
+		return -EBUSY;
+
+	s->stop = false;
+	err = pthread_create(&s->thread, NULL, sampler_thread, s);
+	if (err)
+		return -err;
+
+	s->running = true;
+	return 0;
+}
+
+void sampler_stop(struct sampler *s)
+{
+	if (!s->running)
+		return;
+
+	__atomic_store_n(&s->stop, true, __ATOMIC_RELAXED);
+	pthread_join(s->thread, NULL);
+	s->running = false;
+}
+
+void sampler_fini(struct sampler *s)
+{
+	sampler_stop(s);
+	pmu_group_close(&s->pmu);
+	free(s->ring);
+	free(s->scratch);
+	memset(s, 0, sizeof(*s));
+}
+
+unsigned int sampler_snapshot(struct sampler *s, struct sampler_sample *out)
+{
+	uint64_t head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+	uint64_t first = head > s->size ? head - s->size : 0;
+	uint64_t claimed, skip;
+
+	for (uint64_t n = first; n < head; n++)
+		out[n - first] = s->ring[n & (s->size - 1)];
+
+	/* slot n is reused by sample n + size; drop any that were started */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	claimed = __atomic_load_n(&s->claimed, __ATOMIC_RELAXED);
+	skip = claimed > first + s->size ? claimed - first - s->size : 0;
+	if (skip > head - first)
+		skip = head - first;
+
+	memmove(out, out + skip, (head - first - skip) * sizeof(*out));
+	return head - first - skip;
+}
+
+unsigned int sampler_summary(struct sampler *s, uint64_t start, uint64_t end,
+			     double *values)
+{
+	struct sampler_sample *x = s->scratch;
+	unsigned int count, lo = 0, hi;
+
+	count = sampler_snapshot(s, x);
+	if (!count)
+		return 0;
+
+	for (unsigned int n = 0; n < count && x[n].time <= start; n++)
+		lo = n;
+	for (hi = lo; hi < count - 1 && x[hi].time < end; hi++)
+		;
+
+	for (unsigned int i = 0; i < s->nchannel; i++) {
+		if (s->channel[i].kind == SAMPLER_COUNTER) {
+			values[i] = hi == lo ? NAN :
+				(double)(x[hi].value[i] - x[lo].value[i]) *
+				NSEC_PER_SEC / (x[hi].time - x[lo].time);
+		} else {
+			double sum = 0;
+
+			for (unsigned int n = lo; n <= hi; n++)
+				sum += x[n].value[i];
+			values[i] = sum / (hi - lo + 1);
+		}
+	}
+
+	return hi - lo + 1;
+}
+
+/* Reads a one line sysfs file into @buf, without the newline */
+static int read_line(const char *path, char *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret < 0)
+		return -EIO;
+
+	buf[ret] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+int pkg_temp_open(struct sysfs_dir *d, const char *root)
+{
+	static const struct {
+		const char *class, *prefix, *key, *value, *attr;
+	} sources[] = {
+		{ "thermal", "thermal_zone", "type", "x86_pkg_temp", "temp" },
+		{ "hwmon", "hwmon", "name", "coretemp", "temp1_input" },
+	};
+	char path[512], buf[64];
+
+	if (!root)
+		root = "/sys/class";
+
+	for (unsigned int i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+		struct dirent *de;
+		DIR *dir;
+
+		snprintf(path, sizeof(path), "%s/%s", root, sources[i].class);
+		dir = opendir(path);
+		if (!dir)
+			continue;
+
+		while ((de = readdir(dir))) {
+			int err;
+
+			if (strncmp(de->d_name, sources[i].prefix,
+				    strlen(sources[i].prefix)))
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%s/%s/%s", root,
+				 sources[i].class, de->d_name, sources[i].key);
+			if (read_line(path, buf, sizeof(buf)) ||
+			    strcmp(buf, sources[i].value))
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%s/%s", root,
+				 sources[i].class, de->d_name);
+			closedir(dir);
+
+			err = sysfs_open(d, path);
+			if (err)
+				return err;
+			return sysfs_attr(d, sources[i].attr);
+		}
+		closedir(dir);
+	}
+
+	return -ENOENT;
+}
+
+int stable_gate_init(struct stable_gate *g, struct sysfs_dir *card,
+		     struct sysfs_dir *temp, unsigned int window_ms)
+{
+	memset(g, 0, sizeof(*g));
+	g->freq_tolerance = STABLE_FREQ_TOLERANCE;
+	g->temp_tolerance = STABLE_TEMP_TOLERANCE;
+	g->window_ms = window_ms;
+	g->timeout_ms = window_ms + STABLE_TIMEOUT_MS;
+
+	if (card) {
+		g->freq_attr = sysfs_attr(card, "gt_act_freq_mhz");
+		if (g->freq_attr < 0)
+			return g->freq_attr;
+		g->freq = card;
+	}
+
+	if (temp) {
+		g->temp_attr = pkg_temp_open(temp, NULL);
+		if (g->temp_attr >= 0)
+			g->temp = temp;
+	}
+
+	return 0;
+}
+
+#define STABLE_POLL_US 1000
+
+int stable_wait(const struct stable_gate *g, int fd, uint64_t *waited_ns)
+{
+	struct timespec start = {};
+	struct gpu_load load;
+	uint64_t now, since = 0;
+	int ref_freq = 0, ref_temp = 0;
+	bool begun = false;
+	int err = -ETIMEDOUT;
+
+	gpu_load_init(&load, fd);
+
+	nsec_elapsed(&start);
+	do {
+		int freq = 0, temp = 0;
+
+		gpu_load_poll(&load);
+		now = nsec_elapsed(&start);
+
+		if (g->freq) {
+			freq = sysfs_read(g->freq, g->freq_attr);
+			if (freq < 0) {
+				err = freq;
+				break;
+			}
+		}
+		if (g->temp) {
+			temp = sysfs_read(g->temp, g->temp_attr);
+			if (temp < 0) {
+				err = temp;
+				break;
+			}
+		}
+
+		if (!begun ||
+		    abs(freq - ref_freq) > g->freq_tolerance ||
+		    abs(temp - ref_temp) > g->temp_tolerance) {
+			ref_freq = freq;
+			ref_temp = temp;
+			since = now;
+			begun = true;
+		} else if (now - since >= (uint64_t)g->window_ms * 1000000) {
+			err = 0;
+			break;
+		}
+
+		usleep(STABLE_POLL_US);
+	} while (now < (uint64_t)g->timeout_ms * 1000000);
+
+	gpu_load_fini(&load);
+
+	if (waited_ns)
+		*waited_ns = nsec_elapsed(&start);
+	return err;
+}
+
+int energy_open(struct energy *e, const char *root)
+{
+	struct dirent **zones;
+	char path[512], buf[32];
+	int n, err = -ENOENT;
+
+	memset(e, 0, sizeof(*e));
+	if (!root)
+		root = "/sys/class/powercap";
+
+	/* sorted, so that the domains come out in the same order every run */
+	n = scandir(root, &zones, NULL, alphasort);
+	if (n < 0)
+		return -errno;
+
+	for (int i = 0; i < n; i++) {
+		struct energy_domain *d = &e->domain[e->ndomain];
+		const char *zone = zones[i]->d_name;
+
+		/* intel-rapl-mmio zones count the same energy again */
+		if (strncmp(zone, "intel-rapl:", strlen("intel-rapl:")) ||
+		    e->ndomain == ENERGY_MAX_DOMAINS)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/name", root, zone);
+		if (read_line(path, d->name, sizeof(d->name)))
+			continue;
+		d->package = !strncmp(d->name, "package-", strlen("package-"));
+		if (!d->package && strcmp(d->name, "uncore"))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj",
+			 root, zone);
+		if (read_line(path, buf, sizeof(buf)))
+			continue;
+		d->range = strtoull(buf, NULL, 0);
+
+		snprintf(path, sizeof(path), "%s/%s/energy_uj", root, zone);
+		d->fd = open(path, O_RDONLY);
+		if (d->fd < 0) {
+			err = -errno;
+			continue;
+		}
+		e->ndomain++;
+	}
+
+	for (int i = 0; i < n; i++)
+		free(zones[i]);
+	free(zones);
+
+	return e->ndomain ? 0 : err;
+}
+
+void energy_close(struct energy *e)
+{
+	for (unsigned int i = 0; i < e->ndomain; i++)
+		close(e->domain[i].fd);
+	e->ndomain = 0;
+}
+
+int energy_domain(const struct energy *e, const char *name)
+{
+	for (unsigned int i = 0; i < e->ndomain; i++)
+		if (!strcmp(e->domain[i].name, name))
+			return i;
+
+	return -ENOENT;
+}
+
+int energy_read(const struct energy *e, uint64_t *uj)
+{
+	for (unsigned int i = 0; i < e->ndomain; i++) {
+		char buf[32];
+		ssize_t len;
+
+		len = pread(e->domain[i].fd, buf, sizeof(buf) - 1, 0);
+		if (len < 0)
+			return -errno;
+
+		buf[len] = '\0';
+		uj[i] = strtoull(buf, NULL, 0);
+	}
+
+	return 0;
+}
+
+double energy_joules(const struct energy *e, const uint64_t *start,
+		     const uint64_t *end, double *joules)
+{
+	double package = 0;
+
+	for (unsigned int i = 0; i < e->ndomain; i++) {
+		uint64_t uj = end[i] - start[i];
+
+		/* the counter restarts from 0 after max_energy_range_uj */
+		if (end[i] < start[i])
+			uj = e->domain[i].range - start[i] + end[i];
+
+		if (joules)
+			joules[i] = uj / 1e6;
+		if (e->domain[i].package)
+			package += uj / 1e6;
+	}
+
+	return package;
+}
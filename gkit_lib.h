@@ -40,6 +40,7 @@
 #include <i915_drm.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #define LOCAL_I915_CONTEXT_MAX_USER_PRIORITY	1023
 #define LOCAL_I915_CONTEXT_DEFAULT_PRIORITY	0
@@ -61,6 +62,18 @@ static inline bool fence_busy(int fence)
 	return poll(&(struct pollfd){fence, POLLIN}, 1, 0) == 0;
 }
 
+/**
+ * sync_fence_merge:
+ * @fence1: sync_file fd
+ * @fence2: sync_file fd
+ *
+ * Merges two sync_file fences into a new one that signals once both have
+ * signaled, so that several dependencies can be passed as one in-fence.
+ *
+ * Returns: The new sync_file fd, or -errno on failure.
+ */
+int sync_fence_merge(int fence1, int fence2);
+
 int syncobj_destroy(int fd, uint32_t handle);
 uint32_t syncobj_create(int fd);
 
@@ -178,6 +191,77 @@ void gem_context_destroy(int fd, uint32_t ctx_id);
  */
 int __gem_context_set_priority(int fd, uint32_t ctx_id, int prio);
 
+/**
+ * __gem_context_share_vm:
+ * @fd: open i915 drm file descriptor
+ * @ctx_id: i915 context id
+ * @src_id: context whose address space @ctx_id is to use
+ *
+ * Moves @ctx_id into the ppGTT of @src_id, so that their objects compete
+ * for the same address space. Needs I915_CONTEXT_PARAM_VM, from v5.5.
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int __gem_context_share_vm(int fd, uint32_t ctx_id, uint32_t src_id);
+
+/**
+ * gem_context_pool:
+ *
+ * A stack of idle contexts, all created on the same fd and set to the same
+ * priority, from which contexts can be taken and returned without paying for
+ * CONTEXT_CREATE and CONTEXT_DESTROY on the hot path. The pool is safe to use
+ * from multiple threads.
+ */
+struct gem_context_pool {
+	int fd;
+	int prio;
+	unsigned int count;
+	unsigned int size;
+	uint32_t *ctx;
+	pthread_mutex_t lock;
+};
+
+/**
+ * gem_context_pool_create:
+ * @fd: open i915 drm file descriptor
+ * @count: number of contexts to pre-create
+ * @prio: priority applied to every context in the pool
+ *
+ * Returns: A new pool holding @count idle contexts.
+ */
+struct gem_context_pool *gem_context_pool_create(int fd, unsigned int count, int prio);
+
+/**
+ * gem_context_pool_get:
+ * @pool: context pool
+ *
+ * Takes an idle context from @pool. If the pool has run dry a new context is
+ * created, with the pool's priority applied, so this never fails; the pool
+ * grows to hold it once it is returned.
+ *
+ * Returns: The id of the context.
+ */
+uint32_t gem_context_pool_get(struct gem_context_pool *pool);
+
+/**
+ * gem_context_pool_put:
+ * @pool: context pool
+ * @ctx_id: context previously taken from @pool
+ *
+ * Returns @ctx_id to @pool for reuse. The context must still have the pool's
+ * priority, callers that change it must restore it first.
+ */
+void gem_context_pool_put(struct gem_context_pool *pool, uint32_t ctx_id);
+
+/**
+ * gem_context_pool_destroy:
+ * @pool: context pool
+ *
+ * Destroys every idle context held by @pool and frees it. Contexts that have
+ * not been returned are left to the caller.
+ */
+void gem_context_pool_destroy(struct gem_context_pool *pool);
+
 /**
  * gem_aperture_size:
  * @fd: open i915 drm file descriptor
@@ -241,6 +325,20 @@ void *__gem_mmap__wc(int fd, uint32_t handle, uint64_t offset, uint64_t size, un
  */
 void *gem_mmap__wc(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsigned prot);
 
+/**
+ * __gem_mmap__gtt:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ * @size: size of the gem buffer
+ * @prot: memory protection bits as used by mmap()
+ *
+ * This functions wraps up procedure to establish a memory mapping through the
+ * GTT, which goes through the mappable aperture and its fence registers.
+ *
+ * Returns: A pointer to the created memory mapping, NULL on failure.
+ */
+void *__gem_mmap__gtt(int fd, uint32_t handle, uint64_t size, unsigned prot);
+
 /**
  * gem_mmap__gtt:
  * @fd: open i915 drm file descriptor
@@ -254,6 +352,36 @@ void *gem_mmap__wc(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsi
  */
 void *gem_mmap__gtt(int fd, uint32_t handle, uint64_t size, unsigned prot);
 
+/**
+ * __gem_mmap__cpu:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ * @offset: offset in the gem buffer of the mmap arena
+ * @size: size of the mmap arena
+ * @prot: memory protection bits as used by mmap()
+ *
+ * This functions wraps up procedure to establish a memory mapping through
+ * direct cpu access, bypassing the gpu completely. The mapping is cached,
+ * so coherency with the gpu must be managed with gem_set_domain().
+ *
+ * Returns: A pointer to the created memory mapping, NULL on failure.
+ */
+void *__gem_mmap__cpu(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsigned prot);
+
+/**
+ * gem_mmap__cpu:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ * @offset: offset in the gem buffer of the mmap arena
+ * @size: size of the mmap arena
+ * @prot: memory protection bits as used by mmap()
+ *
+ * Like __gem_mmap__cpu() except we assert on failure.
+ *
+ * Returns: A pointer to the created memory mapping
+ */
+void *gem_mmap__cpu(int fd, uint32_t handle, uint64_t offset, uint64_t size, unsigned prot);
+
 /**
  * __gem_wait:
  * @fd: open i915 drm file descriptor
@@ -300,6 +428,41 @@ void gem_sync(int fd, uint32_t handle);
  */
 void gem_set_tiling(int fd, uint32_t handle, uint32_t tiling, uint32_t stride);
 
+/**
+ * __gem_set_caching:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ * @caching: caching mode bits, e.g. I915_CACHING_CACHED
+ *
+ * This wraps the SET_CACHING ioctl, which selects whether the gpu snoops the
+ * cpu caches (or uses the LLC) when accessing the buffer object. This is
+ * allowed to fail, e.g. when snooping is not supported, with -errno returned.
+ *
+ * Returns: 0 on success, -errno on failure.
+ */
+int __gem_set_caching(int fd, uint32_t handle, uint32_t caching);
+
+/**
+ * gem_set_caching:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ * @caching: caching mode bits, e.g. I915_CACHING_CACHED
+ *
+ * Like __gem_set_caching() except we assert on failure.
+ */
+void gem_set_caching(int fd, uint32_t handle, uint32_t caching);
+
+/**
+ * gem_get_caching:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ *
+ * This wraps the GET_CACHING ioctl.
+ *
+ * Returns: The current caching mode of the buffer object.
+ */
+uint32_t gem_get_caching(int fd, uint32_t handle);
+
 /**
  * gem_close:
  * @fd: open i915 drm file descriptor
@@ -335,6 +498,48 @@ uint32_t gem_create(int fd, uint64_t size);
  */
 void gem_write(int fd, uint32_t handle, uint64_t offset, const void *buf, uint64_t length);
 
+/**
+ * gem_read:
+ * @fd: open i915 drm file descriptor
+ * @handle: gem buffer object handle
+ * @offset: offset within the buffer of the subrange
+ * @buf: pointer to the data to read into
+ * @length: size of the subrange
+ *
+ * This wraps the PREAD ioctl, which is to download a linear data to a subrange
+ * of a gem buffer object.
+ */
+void gem_read(int fd, uint32_t handle, uint64_t offset, void *buf, uint64_t length);
+
+/**
+ * __gem_userptr:
+ * @fd: open i915 drm file descriptor
+ * @ptr: userptr pointer to be passed
+ * @size: desired size of the buffer
+ * @read_only: specify whether userptr is opened read only
+ * @flags: other userptr flags, e.g. I915_USERPTR_UNSYNCHRONIZED
+ * @handle: returned handle for the object
+ *
+ * This wraps the USERPTR ioctl, which wraps ordinary page-aligned process
+ * memory in a gem buffer object so the gpu can access it without a copy.
+ *
+ * Returns: 0 on success, -errno on failure.
+ */
+int __gem_userptr(int fd, void *ptr, uint64_t size, int read_only, uint32_t flags, uint32_t *handle);
+
+/**
+ * gem_userptr:
+ * @fd: open i915 drm file descriptor
+ * @ptr: userptr pointer to be passed
+ * @size: desired size of the buffer
+ * @read_only: specify whether userptr is opened read only
+ * @flags: other userptr flags, e.g. I915_USERPTR_UNSYNCHRONIZED
+ * @handle: returned handle for the object
+ *
+ * Like __gem_userptr() except we assert on failure.
+ */
+void gem_userptr(int fd, void *ptr, uint64_t size, int read_only, uint32_t flags, uint32_t *handle);
+
 int __gem_execbuf(int fd, struct drm_i915_gem_execbuffer2 *execbuf);
 /**
  * gem_execbuf:
@@ -346,4 +551,921 @@ int __gem_execbuf(int fd, struct drm_i915_gem_execbuffer2 *execbuf);
  */
 void gem_execbuf(int fd, struct drm_i915_gem_execbuffer2 *execbuf);
 
+/**
+ * memcpy_kernel:
+ * @name: instruction set used by the kernel
+ * @supported: whether the running cpu can execute the kernel
+ * @to_wc: copy into write-combined or GTT memory with streaming stores
+ * @from_wc: copy out of write-combined or GTT memory with streaming loads,
+ *	staged through a bounce buffer the size of the cpu's fill buffers
+ * @fill_wc: fill write-combined or GTT memory with a repeated dword, using
+ *	streaming stores
+ *
+ * One set of copy routines for uncached mappings. Plain loads from WC memory
+ * are uncached and serialised, while MOVNTDQA fetches a whole line at a time;
+ * likewise streaming stores fill complete write-combining buffers without
+ * reading the destination.
+ */
+struct memcpy_kernel {
+	const char *name;
+	bool (*supported)(void);
+	void *(*to_wc)(void *dst, const void *src, size_t len);
+	void *(*from_wc)(void *dst, const void *src, size_t len);
+	void *(*fill_wc)(void *dst, uint32_t pattern, size_t len);
+};
+
+/* All kernels, best last, terminated by an entry with a NULL name */
+extern const struct memcpy_kernel memcpy_kernels[];
+
+/**
+ * memcpy_to_wc:
+ * @dst: destination in a WC or GTT mapping
+ * @src: source in ordinary memory
+ * @len: number of bytes to copy
+ *
+ * Copies using the best memcpy_kernel supported by the cpu, chosen by cpuid
+ * on first use.
+ *
+ * Returns: @dst
+ */
+void *memcpy_to_wc(void *dst, const void *src, size_t len);
+
+/**
+ * memcpy_from_wc:
+ * @dst: destination in ordinary memory
+ * @src: source in a WC or GTT mapping
+ * @len: number of bytes to copy
+ *
+ * Like memcpy_to_wc() but for readback from an uncached mapping.
+ *
+ * Returns: @dst
+ */
+void *memcpy_from_wc(void *dst, const void *src, size_t len);
+
+/**
+ * fill_to_wc:
+ * @dst: destination in a WC or GTT mapping, dword aligned
+ * @pattern: dword to repeat, e.g. a replicated 8 or 16bpp colour
+ * @len: number of bytes to fill, a multiple of 4
+ *
+ * The cpu equivalent of a solid fill blit, using the same memcpy_kernel as
+ * memcpy_to_wc().
+ *
+ * Returns: @dst
+ */
+void *fill_to_wc(void *dst, uint32_t pattern, size_t len);
+
+/**
+ * cpu_cache_flush:
+ * @ptr: start of the range
+ * @len: length of the range in bytes
+ * @invalidate: whether the lines must also be dropped from the cpu caches
+ *
+ * Writes the cachelines covering the range back to memory, so that the gpu
+ * sees the cpu's writes to a buffer object it does not snoop. With
+ * @invalidate the lines are evicted as well, which is needed before reading
+ * back what the gpu wrote. Uses clwb when only a writeback is needed and
+ * clflushopt when available, falling back to clflush, and fences afterwards.
+ */
+void cpu_cache_flush(void *ptr, size_t len, bool invalidate);
+
+/**
+ * cpu_cache_flush_name:
+ * @invalidate: as passed to cpu_cache_flush()
+ *
+ * Returns: The name of the instruction cpu_cache_flush() will use.
+ */
+const char *cpu_cache_flush_name(bool invalidate);
+
+/**
+ * blt_surface:
+ * @handle: gem buffer object handle
+ * @pitch: stride of the surface in bytes
+ * @tiling: I915_TILING_NONE, _X, _Y, _Yf or _Ys
+ * @x: left edge of the blit in pixels
+ * @y: top edge of the blit in pixels
+ *
+ * One side of a blit for blt_src_copy() and blt_fast_copy(), which are 32bpp,
+ * or the target of blt_fill(). The tiling is only used to encode the command,
+ * the kernel's idea of the object's tiling is not consulted.
+ */
+struct blt_surface {
+	uint32_t handle;
+	uint32_t pitch;
+	uint32_t tiling;
+	uint32_t x, y;
+};
+
+/**
+ * blt_src_copy:
+ * @batch: start of the batch buffer
+ * @b: where in @batch to emit the commands
+ * @reloc: array of two relocations, filled in for @dst and @src
+ * @src: source surface
+ * @dst: destination surface
+ * @width: width of the blit in pixels
+ * @height: height of the blit in pixels
+ *
+ * Emits a gen8+ XY_SRC_COPY_BLT. Y tiling is selected through BCS_SWCTRL,
+ * which is set before and cleared after the blit; Yf and Ys are not
+ * supported by the command.
+ *
+ * Returns: The end of the emitted commands, or NULL if a tiling mode is
+ * unsupported.
+ */
+uint32_t *blt_src_copy(const uint32_t *batch, uint32_t *b,
+		       struct drm_i915_gem_relocation_entry *reloc,
+		       const struct blt_surface *src,
+		       const struct blt_surface *dst,
+		       uint32_t width, uint32_t height);
+
+/**
+ * blt_fast_copy:
+ * @batch: start of the batch buffer
+ * @b: where in @batch to emit the commands
+ * @reloc: array of two relocations, filled in for @dst and @src
+ * @src: source surface
+ * @dst: destination surface
+ * @width: width of the blit in pixels
+ * @height: height of the blit in pixels
+ *
+ * Emits an XY_FAST_COPY_BLT, available on gen9+, which handles linear, X,
+ * Y, Yf and Ys surfaces in any combination.
+ *
+ * Returns: The end of the emitted commands.
+ */
+uint32_t *blt_fast_copy(const uint32_t *batch, uint32_t *b,
+			struct drm_i915_gem_relocation_entry *reloc,
+			const struct blt_surface *src,
+			const struct blt_surface *dst,
+			uint32_t width, uint32_t height);
+
+/**
+ * blt_fill:
+ * @batch: start of the batch buffer
+ * @b: where in @batch to emit the commands
+ * @reloc: a single relocation, filled in for @dst
+ * @dst: surface to fill
+ * @bpp: 8, 16 (565) or 32
+ * @width: width of the fill in pixels
+ * @height: height of the fill in pixels
+ * @color: fill colour in the format given by @bpp
+ *
+ * Emits a gen8+ XY_COLOR_BLT. As with blt_src_copy(), Y tiling goes through
+ * BCS_SWCTRL and Yf and Ys are not supported.
+ *
+ * Returns: The end of the emitted commands, or NULL if @bpp or the tiling
+ * mode is unsupported.
+ */
+uint32_t *blt_fill(const uint32_t *batch, uint32_t *b,
+		   struct drm_i915_gem_relocation_entry *reloc,
+		   const struct blt_surface *dst, unsigned int bpp,
+		   uint32_t width, uint32_t height, uint32_t color);
+
+/* The y coordinates of a blit are signed 16 bit */
+#define BLT_MAX_ROWS ((1 << 15) - 1)
+
+#define BLT_LINEAR_PITCH (16 * 1024)
+#define BLT_LINEAR_MAX_SIZE ((uint64_t)BLT_MAX_ROWS * BLT_LINEAR_PITCH)
+
+/**
+ * blt_linear_copy:
+ * @batch: batch buffer, with room for 12 dwords
+ * @reloc: array of two relocations, filled in for @dst and @src
+ * @src: source handle
+ * @dst: destination handle
+ * @size: bytes to copy, a multiple of the row length and at most
+ *   BLT_LINEAR_MAX_SIZE
+ *
+ * Emits a whole batch copying @size bytes from @src to @dst with
+ * blt_src_copy(), as 32bpp rows of BLT_LINEAR_PITCH bytes, or as one row if
+ * @size is smaller.
+ *
+ * Returns: The length of the batch in bytes.
+ */
+int blt_linear_copy(uint32_t *batch,
+		    struct drm_i915_gem_relocation_entry *reloc,
+		    uint32_t src, uint32_t dst, uint64_t size);
+
+/**
+ * blt_linear_batch_create:
+ * @fd: open i915 drm file descriptor
+ * @size: bytes to copy
+ *
+ * Creates a batch of blt_linear_copy() to reuse with blt_linear_execbuf()
+ * for any pair of objects of @size bytes; only the relocations differ.
+ *
+ * Returns: The file-private handle of the batch.
+ */
+uint32_t blt_linear_batch_create(int fd, uint64_t size);
+
+/**
+ * blt_linear_execbuf:
+ * @fd: open i915 drm file descriptor
+ * @batch: handle from blt_linear_batch_create() for @size
+ * @src: source handle
+ * @dst: destination handle
+ * @size: bytes to copy
+ *
+ * Submits @batch to the blitter to copy @src to @dst, without waiting.
+ */
+void blt_linear_execbuf(int fd, uint32_t batch, uint32_t src, uint32_t dst,
+			uint64_t size);
+
+/**
+ * gem_nop_batch_create:
+ * @fd: open i915 drm file descriptor
+ * @size: size of the batch in bytes
+ * @arb_interval: number of dwords between MI_ARB_CHECK, 0 for none
+ *
+ * Creates a batch buffer of @size bytes filled with MI_NOOP and terminated by
+ * MI_BATCH_BUFFER_END. Its execution time scales with @size, so it is used to
+ * keep an engine busy for a controlled amount of time. Every @arb_interval
+ * dwords an MI_ARB_CHECK is inserted, giving the scheduler a point at which
+ * the batch may be preempted; with an @arb_interval of 0 the batch can only
+ * be switched out once it completes.
+ *
+ * Returns: The file-private handle of the created buffer object
+ */
+uint32_t gem_nop_batch_create(int fd, uint64_t size, unsigned int arb_interval);
+
+/**
+ * sort_u64:
+ * @v: array of samples
+ * @count: number of samples
+ *
+ * Sorts @v into ascending order, ready for percentile_u64().
+ */
+void sort_u64(uint64_t *v, unsigned int count);
+
+/**
+ * percentile_u64:
+ * @sorted: array of samples sorted by sort_u64()
+ * @count: number of samples
+ * @pct: percentile to report, from 0 to 100
+ *
+ * Returns: The nearest-rank @pct percentile of @sorted, or 0 if empty.
+ */
+uint64_t percentile_u64(const uint64_t *sorted, unsigned int count, double pct);
+
+#define SYSFS_MAX_ATTRS 32
+
+/**
+ * sysfs_dir:
+ * @root: the directory, e.g. /sys/class/drm/card0
+ * @nattr: number of attributes looked up so far
+ * @attr: name and cached read and write descriptors of each attribute
+ *
+ * A directory of integer attributes whose files stay open once looked up,
+ * so that sampling one is a single pread().
+ */
+struct sysfs_dir {
+	char root[128];
+	unsigned int nattr;
+	struct {
+		char name[32];
+		int rd, wr;
+	} attr[SYSFS_MAX_ATTRS];
+};
+
+/**
+ * sysfs_open:
+ * @d: directory to initialise
+ * @root: path of the directory, or NULL for the first i915 card's
+ *
+ * Resolves the directory once; nothing is opened until sysfs_attr().
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int sysfs_open(struct sysfs_dir *d, const char *root);
+
+/**
+ * sysfs_close:
+ * @d: directory
+ *
+ * Closes every cached descriptor.
+ */
+void sysfs_close(struct sysfs_dir *d);
+
+/**
+ * sysfs_attr:
+ * @d: directory
+ * @name: attribute under @d->root, e.g. "gt_act_freq_mhz"
+ *
+ * Looks @name up, opening it for reading on first use.
+ *
+ * Returns: An index for sysfs_read() and sysfs_write(), or a negative errno.
+ */
+int sysfs_attr(struct sysfs_dir *d, const char *name);
+
+/**
+ * sysfs_read:
+ * @d: directory
+ * @attr: index from sysfs_attr()
+ *
+ * Read as 64 bits: residency counters such as power/rc6_residency_ms pass
+ * INT_MAX within weeks.
+ *
+ * Returns: The value of the attribute, or a negative errno.
+ */
+int64_t sysfs_read(struct sysfs_dir *d, int attr);
+
+/**
+ * sysfs_read_batch:
+ * @d: directory
+ * @attr: indices from sysfs_attr()
+ * @values: filled with each value, or its negative errno
+ * @count: number of attributes
+ *
+ * Reads @count attributes back to back, for sampling them together.
+ *
+ * Returns: 0 if every read succeeded, otherwise the first negative errno.
+ */
+int sysfs_read_batch(struct sysfs_dir *d, const int *attr, int64_t *values,
+		     unsigned int count);
+
+/**
+ * sysfs_write:
+ * @d: directory
+ * @attr: index from sysfs_attr()
+ * @value: value to write
+ *
+ * Opens the attribute for writing on first use and keeps it open.
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int sysfs_write(struct sysfs_dir *d, int attr, int value);
+
+/**
+ * gpu_freq:
+ * @sysfs: the card's sysfs directory
+ * @act: index of gt_act_freq_mhz in @sysfs
+ * @min: gt_min_freq_mhz when opened, restored by gpu_freq_close()
+ * @max: gt_max_freq_mhz when opened, restored by gpu_freq_close()
+ * @rpn: lowest frequency the gpu runs at
+ * @rp1: most efficient frequency, or 0 if not exposed
+ * @rp0: highest frequency outside of boosting
+ * @steps: frequencies from @rpn to @rp0, ascending
+ * @nsteps: number of entries in @steps
+ *
+ * RPS control through the card's sysfs attributes. Nothing but the files
+ * under @sysfs is touched, so it may point at a fake tree of plain files.
+ */
+struct gpu_freq {
+	struct sysfs_dir sysfs;
+	int act;
+	int min, max;
+	int rpn, rp1, rp0;
+	int *steps;
+	unsigned int nsteps;
+};
+
+/* Default distance between steps, a multiple of every gen's granularity */
+#define GPU_FREQ_STEP 50
+
+/**
+ * gpu_freq_open:
+ * @f: frequency control to initialise
+ * @root: sysfs directory of the card, or NULL for the first i915 card
+ * @step: MHz between steps, or 0 for GPU_FREQ_STEP
+ *
+ * Reads the frequency limits and current settings, and lists the steps from
+ * RPn to RP0 inclusive.
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int gpu_freq_open(struct gpu_freq *f, const char *root, int step);
+
+/**
+ * gpu_freq_close:
+ * @f: frequency control
+ *
+ * Restores the min and max frequencies found by gpu_freq_open() and closes
+ * the sysfs directory.
+ */
+void gpu_freq_close(struct gpu_freq *f);
+
+/**
+ * gpu_freq_read:
+ * @f: frequency control
+ * @name: attribute under @f->sysfs, e.g. "gt_cur_freq_mhz"
+ *
+ * Returns: The value of the attribute, or a negative errno.
+ */
+int gpu_freq_read(struct gpu_freq *f, const char *name);
+
+/**
+ * gpu_freq_write:
+ * @f: frequency control
+ * @name: attribute under @f->sysfs
+ * @value: value to write
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int gpu_freq_write(struct gpu_freq *f, const char *name, int value);
+
+/**
+ * gpu_freq_set:
+ * @f: frequency control
+ * @min: new gt_min_freq_mhz
+ * @max: new gt_max_freq_mhz
+ *
+ * Writes both limits in whichever order keeps min <= max throughout, as the
+ * kernel rejects anything else.
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int gpu_freq_set(struct gpu_freq *f, int min, int max);
+
+/**
+ * gpu_freq_settle:
+ * @f: frequency control
+ * @fd: open i915 drm file descriptor used to keep the gpu busy, or -1
+ * @mhz: frequency the gpu has been pinned to
+ * @timeout_ms: how long to wait
+ *
+ * Polls gt_act_freq_mhz until several consecutive reads are within rounding
+ * of @mhz. An idle gpu drops into rc6 and reports nothing useful, so with a
+ * valid @fd nop batches are kept running on the render engine meanwhile.
+ *
+ * Returns: The settled frequency, or -ETIMEDOUT or another negative errno.
+ */
+int gpu_freq_settle(struct gpu_freq *f, int fd, int mhz, unsigned int timeout_ms);
+
+/**
+ * gpu_freq_sweep:
+ * @f: frequency control
+ * @fd: as for gpu_freq_settle()
+ * @func: called at each step with the pinned frequency, the settled
+ *	frequency or a negative errno if it never settled, and @data
+ * @data: passed through to @func
+ *
+ * Pins min and max to each of @f->steps in turn, waits for the gpu to settle
+ * and runs @func. The limits found by gpu_freq_open() are restored after.
+ *
+ * Returns: 0 on success, or the negative errno of the first failed write.
+ */
+int gpu_freq_sweep(struct gpu_freq *f, int fd,
+		   void (*func)(int mhz, int act, void *data), void *data);
+
+/* i915 PMU event configs, as in the uapi i915_drm.h of v4.16+ */
+#define LOCAL_I915_ENGINE_CLASS_RENDER		0
+#define LOCAL_I915_ENGINE_CLASS_COPY		1
+#define LOCAL_I915_ENGINE_CLASS_VIDEO		2
+#define LOCAL_I915_ENGINE_CLASS_VIDEO_ENHANCE	3
+
+#define LOCAL_I915_SAMPLE_BUSY	0
+#define LOCAL_I915_SAMPLE_WAIT	1
+#define LOCAL_I915_SAMPLE_SEMA	2
+
+#define LOCAL_I915_PMU_ENGINE(class, instance, sample) \
+	((class) << 12 | (instance) << 4 | (sample))
+#define LOCAL_I915_PMU_OTHER(x) (LOCAL_I915_PMU_ENGINE(0xff, 0xff, 0xf) + 1 + (x))
+#define LOCAL_I915_PMU_ACTUAL_FREQUENCY		LOCAL_I915_PMU_OTHER(0)
+#define LOCAL_I915_PMU_REQUESTED_FREQUENCY	LOCAL_I915_PMU_OTHER(1)
+#define LOCAL_I915_PMU_INTERRUPTS		LOCAL_I915_PMU_OTHER(2)
+#define LOCAL_I915_PMU_RC6_RESIDENCY		LOCAL_I915_PMU_OTHER(3)
+
+/**
+ * i915_pmu_type:
+ *
+ * Returns: The perf event type of the i915 PMU, or a negative errno if the
+ * kernel does not expose one.
+ */
+int i915_pmu_type(void);
+
+/**
+ * i915_pmu_open:
+ * @config: event, e.g. LOCAL_I915_PMU_ENGINE(class, instance, sample)
+ * @group: leader to add the event to, or -1 to start a new group
+ *
+ * The i915 PMU counts system wide, so the event is opened for all processes
+ * on the first cpu.
+ *
+ * Returns: The perf event fd, or a negative errno.
+ */
+int i915_pmu_open(uint64_t config, int group);
+
+#define PMU_MAX_EVENTS 32
+
+/**
+ * pmu_group:
+ * @leader: fd of the first event, which the others are read through
+ * @nevent: number of events
+ * @event: name, config and fd of each event
+ *
+ * i915 PMU events opened as one perf group, so that a single read() samples
+ * them all at the same instant.
+ */
+struct pmu_group {
+	int leader;
+	unsigned int nevent;
+	struct pmu_event {
+		char name[32];
+		uint64_t config;
+		int fd;
+	} event[PMU_MAX_EVENTS];
+};
+
+/**
+ * pmu_sample:
+ * @time: sampler_now() when the group was read
+ * @value: the count of each event
+ */
+struct pmu_sample {
+	uint64_t time;
+	uint64_t value[PMU_MAX_EVENTS];
+};
+
+/**
+ * pmu_group_init:
+ * @g: group to initialise, empty
+ */
+void pmu_group_init(struct pmu_group *g);
+
+/**
+ * pmu_group_add:
+ * @g: group
+ * @name: label for the event
+ * @config: i915 PMU event
+ *
+ * The first event added becomes the group leader.
+ *
+ * Returns: The index of the event in @g, or a negative errno.
+ */
+int pmu_group_add(struct pmu_group *g, const char *name, uint64_t config);
+
+/**
+ * pmu_group_add_all:
+ * @g: group
+ *
+ * Adds the busy, wait and sema events of every engine the PMU knows,
+ * named e.g. "rcs0-busy", then "actual-frequency", "requested-frequency",
+ * "interrupts" and "rc6-residency". Events the kernel or the platform does
+ * not support are left out.
+ *
+ * Returns: The number of events in @g, or a negative errno if there are none.
+ */
+int pmu_group_add_all(struct pmu_group *g);
+
+/**
+ * pmu_group_find:
+ * @g: group
+ * @name: label given to pmu_group_add()
+ *
+ * Returns: The index of @name in @g, or -ENOENT.
+ */
+int pmu_group_find(const struct pmu_group *g, const char *name);
+
+/**
+ * pmu_group_read:
+ * @g: group
+ * @s: sample to fill in
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int pmu_group_read(const struct pmu_group *g, struct pmu_sample *s);
+
+/**
+ * pmu_group_rates:
+ * @g: group
+ * @start: pmu_group_read() at the start of a measurement
+ * @end: pmu_group_read() at its end
+ * @rates: one result per event
+ *
+ * Turns the counts into a rate per second: ns per second for busy, wait,
+ * sema and rc6, MHz for the frequencies, and interrupts per second.
+ */
+void pmu_group_rates(const struct pmu_group *g, const struct pmu_sample *start,
+		     const struct pmu_sample *end, double *rates);
+
+/**
+ * pmu_group_close:
+ * @g: group
+ */
+void pmu_group_close(struct pmu_group *g);
+
+#define SAMPLER_MAX_CHANNELS 16
+
+/**
+ * sampler_kind:
+ * @SAMPLER_GAUGE: an instantaneous value, such as gt_act_freq_mhz
+ * @SAMPLER_COUNTER: a monotonic count, such as rc6 residency or PMU busy ns
+ */
+enum sampler_kind {
+	SAMPLER_GAUGE,
+	SAMPLER_COUNTER,
+};
+
+/**
+ * sampler_sample:
+ * @time: CLOCK_MONOTONIC ns, as returned by sampler_now()
+ * @value: one value per channel, in the order they were added
+ */
+struct sampler_sample {
+	uint64_t time;
+	int64_t value[SAMPLER_MAX_CHANNELS];
+};
+
+/**
+ * sampler:
+ * @interval_ns: time between samples taken by the thread
+ * @size: capacity of @ring, a power of two
+ * @ring: the most recent @size samples
+ * @head: number of samples published
+ * @claimed: number of samples started; ahead of @head while one is written
+ * @nchannel: number of channels
+ * @channel: how to read each channel
+ * @pmu: the PMU channels, read together once per sample
+ *
+ * Telemetry taken at a fixed interval by a background thread into a ring
+ * with a single writer. Readers never block it: they copy what they need
+ * and discard whatever was overwritten meanwhile.
+ */
+struct sampler {
+	uint64_t interval_ns;
+	unsigned int size;
+	struct sampler_sample *ring, *scratch;
+	uint64_t head, claimed;
+	unsigned int nchannel;
+	struct sampler_channel {
+		char name[32];
+		enum sampler_kind kind;
+		struct sysfs_dir *sysfs;
+		int attr;
+		int pmu;
+		uint64_t (*read)(void *data);
+		void *data;
+	} channel[SAMPLER_MAX_CHANNELS];
+	struct pmu_group pmu;
+	pthread_t thread;
+	bool running, stop;
+};
+
+/**
+ * sampler_now:
+ *
+ * Returns: The current time on the sampler's clock, to mark the start and
+ * end of a measurement.
+ */
+uint64_t sampler_now(void);
+
+/**
+ * sampler_init:
+ * @s: sampler to initialise
+ * @size: minimum number of samples to keep, rounded up to a power of two
+ * @interval_us: time between samples
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int sampler_init(struct sampler *s, unsigned int size, unsigned int interval_us);
+
+/**
+ * sampler_add_sysfs:
+ * @s: sampler
+ * @d: directory holding the attribute, which must outlive @s
+ * @name: attribute under @d, e.g. "gt_act_freq_mhz"
+ * @kind: whether the attribute is a gauge or a counter
+ *
+ * Returns: The channel index, or a negative errno.
+ */
+int sampler_add_sysfs(struct sampler *s, struct sysfs_dir *d,
+		      const char *name, enum sampler_kind kind);
+
+/**
+ * sampler_add_pmu:
+ * @s: sampler
+ * @name: label for the channel
+ * @config: i915 PMU event, all of which are counters
+ *
+ * Every PMU channel joins the same group, so that they are sampled with a
+ * single read().
+ *
+ * Returns: The channel index, or a negative errno.
+ */
+int sampler_add_pmu(struct sampler *s, const char *name, uint64_t config);
+
+/**
+ * sampler_add_counter:
+ * @s: sampler
+ * @name: label for the channel
+ * @read: returns the current value, called from the sampler thread
+ * @data: passed to @read
+ * @kind: whether @read returns a gauge or a counter
+ *
+ * Returns: The channel index, or a negative errno.
+ */
+int sampler_add_counter(struct sampler *s, const char *name,
+			uint64_t (*read)(void *data), void *data,
+			enum sampler_kind kind);
+
+/**
+ * sampler_poll:
+ * @s: sampler
+ *
+ * Takes one sample of every channel, as the thread does every interval.
+ */
+void sampler_poll(struct sampler *s);
+
+/**
+ * sampler_start:
+ * @s: sampler
+ *
+ * Starts the background thread.
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int sampler_start(struct sampler *s);
+
+/**
+ * sampler_stop:
+ * @s: sampler
+ *
+ * Stops the background thread; the samples remain readable.
+ */
+void sampler_stop(struct sampler *s);
+
+/**
+ * sampler_fini:
+ * @s: sampler
+ *
+ * Stops the thread if need be, closes the PMU events and frees the ring.
+ */
+void sampler_fini(struct sampler *s);
+
+/**
+ * sampler_snapshot:
+ * @s: sampler
+ * @out: room for @s->size samples
+ *
+ * Copies the samples still in the ring, oldest first.
+ *
+ * Returns: The number of samples copied.
+ */
+unsigned int sampler_snapshot(struct sampler *s, struct sampler_sample *out);
+
+/**
+ * sampler_summary:
+ * @s: sampler
+ * @start: sampler_now() at the start of the measurement
+ * @end: sampler_now() at its end
+ * @values: one result per channel
+ *
+ * Aligns the samples with a measurement, using those from the last taken at
+ * or before @start to the first taken at or after @end. Gauges are averaged
+ * over them; counters become a rate per second, NAN if only one sample
+ * falls in the window.
+ *
+ * Returns: The number of samples used, 0 if there were none.
+ */
+unsigned int sampler_summary(struct sampler *s, uint64_t start, uint64_t end,
+			     double *values);
+
+/**
+ * pkg_temp_open:
+ * @d: directory to initialise
+ * @root: sysfs class directory, or NULL for /sys/class
+ *
+ * Finds the cpu package temperature: the x86_pkg_temp thermal zone, or
+ * failing that the first coretemp hwmon device.
+ *
+ * Returns: The index in @d of the temperature, in millidegrees Celsius, or a
+ * negative errno.
+ */
+int pkg_temp_open(struct sysfs_dir *d, const char *root);
+
+/**
+ * stable_gate:
+ * @freq: card directory to watch gt_act_freq_mhz in, or NULL
+ * @freq_attr: index of gt_act_freq_mhz in @freq
+ * @freq_tolerance: MHz the frequency may wander
+ * @temp: directory of a temperature to watch, or NULL
+ * @temp_attr: index of the temperature in @temp
+ * @temp_tolerance: millidegrees the temperature may wander
+ * @window_ms: how long both must stay within tolerance
+ * @timeout_ms: when to give up
+ *
+ * Conditions for stable_wait() to let a measurement start.
+ */
+struct stable_gate {
+	struct sysfs_dir *freq;
+	int freq_attr;
+	int freq_tolerance;
+	struct sysfs_dir *temp;
+	int temp_attr;
+	int temp_tolerance;
+	unsigned int window_ms;
+	unsigned int timeout_ms;
+};
+
+#define STABLE_FREQ_TOLERANCE 25
+#define STABLE_TEMP_TOLERANCE 1000
+#define STABLE_TIMEOUT_MS 10000
+
+/**
+ * stable_gate_init:
+ * @g: gate to initialise
+ * @card: the card's sysfs directory, or NULL not to watch the frequency
+ * @temp: directory to open the package temperature in, or NULL not to
+ *	watch it
+ * @window_ms: how long both must stay within tolerance
+ *
+ * Fills in @g with STABLE_FREQ_TOLERANCE MHz, STABLE_TEMP_TOLERANCE
+ * millidegrees and a timeout of STABLE_TIMEOUT_MS beyond the window. A
+ * temperature that cannot be found is left unwatched, with @g->temp NULL.
+ *
+ * Returns: 0 on success, or a negative errno if gt_act_freq_mhz is missing.
+ */
+int stable_gate_init(struct stable_gate *g, struct sysfs_dir *card,
+		     struct sysfs_dir *temp, unsigned int window_ms);
+
+/**
+ * stable_wait:
+ * @g: gate
+ * @fd: open i915 drm file descriptor used to keep the gpu busy, or -1
+ * @waited_ns: set to the time spent waiting, stable or not
+ *
+ * Waits for a stretch of @g->window_ms over which the frequency and the
+ * temperature stay within their tolerance of the values that began it.
+ * Any excursion begins a new stretch. As in gpu_freq_settle(), a valid @fd
+ * keeps nop batches running so that the gpu warms up rather than idles.
+ *
+ * Returns: 0 once stable, -ETIMEDOUT, or a negative errno from a read.
+ */
+int stable_wait(const struct stable_gate *g, int fd, uint64_t *waited_ns);
+
+#define ENERGY_MAX_DOMAINS 8
+
+/**
+ * energy:
+ * @ndomain: number of domains found
+ * @domain: the RAPL domains, in powercap zone order
+ *
+ * The RAPL energy counters of the cpu packages, and of the uncore (which
+ * includes the integrated gpu) where the platform exposes it.
+ */
+struct energy {
+	unsigned int ndomain;
+	struct energy_domain {
+		char name[32];
+		bool package;
+		int fd;
+		uint64_t range;
+	} domain[ENERGY_MAX_DOMAINS];
+};
+
+/**
+ * energy_open:
+ * @e: energy counters to initialise
+ * @root: powercap class directory, or NULL for /sys/class/powercap
+ *
+ * Opens the energy_uj counter of every intel-rapl package-N and uncore zone.
+ * Reading them usually requires root.
+ *
+ * Returns: 0 if any were found, or a negative errno.
+ */
+int energy_open(struct energy *e, const char *root);
+
+/**
+ * energy_close:
+ * @e: energy counters
+ */
+void energy_close(struct energy *e);
+
+/**
+ * energy_domain:
+ * @e: energy counters
+ * @name: RAPL zone name, such as "package-0" or "uncore"
+ *
+ * Returns: The index of @name in @e->domain, or -ENOENT.
+ */
+int energy_domain(const struct energy *e, const char *name);
+
+/**
+ * energy_read:
+ * @e: energy counters
+ * @uj: one counter per domain, in microjoules
+ *
+ * Samples every counter, at the start or end of a measured region.
+ *
+ * Returns: 0 on success, or a negative errno.
+ */
+int energy_read(const struct energy *e, uint64_t *uj);
+
+/**
+ * energy_joules:
+ * @e: energy counters
+ * @start: energy_read() at the start of the region
+ * @end: energy_read() at its end
+ * @joules: energy used per domain, or NULL
+ *
+ * Allows for each counter wrapping around once at max_energy_range_uj,
+ * which takes tens of minutes at full power. The counters are updated
+ * about once a millisecond, so shorter regions are mostly noise.
+ *
+ * Returns: The energy used by all the packages together.
+ */
+double energy_joules(const struct energy *e, const uint64_t *start,
+		     const uint64_t *end, double *joules);
+
 #endif  // __INTEL_GKIT_LIB_H